@@ -36,6 +36,24 @@ int pscnv_gem_new(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags,
 	return 0;
 }
 
+int pscnv_gem_userptr(int fd, uint32_t cookie, uint32_t flags, void *addr, uint64_t size, uint32_t *handle, uint64_t *map_handle) {
+	int ret;
+	struct drm_pscnv_gem_userptr req;
+	req.cookie = cookie;
+	req.flags = flags;
+	req._pad = 0;
+	req.addr = (uintptr_t)addr;
+	req.size = size;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_GEM_USERPTR, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (handle)
+		*handle = req.handle;
+	if (map_handle)
+		*map_handle = req.map_handle;
+	return 0;
+}
+
 int pscnv_gem_info(int fd, uint32_t handle, uint32_t *cookie, uint32_t *flags, uint32_t *tile_flags, uint64_t *size, uint64_t *map_handle, uint32_t *user) {
 	int ret;
 	struct drm_pscnv_gem_info req;
@@ -90,6 +108,33 @@ int pscnv_gem_open(int fd, uint32_t name, uint32_t *handle, uint64_t *size) {
 	return 0;
 }
 
+int pscnv_prime_export(int fd, uint32_t handle, int *prime_fd) {
+	int ret;
+	struct drm_prime_handle req;
+	req.handle = handle;
+	req.flags = DRM_CLOEXEC;
+	req.fd = -1;
+	ret = drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &req);
+	if (ret)
+		return ret;
+	if (prime_fd)
+		*prime_fd = req.fd;
+	return 0;
+}
+
+int pscnv_prime_import(int fd, int prime_fd, uint32_t *handle) {
+	int ret;
+	struct drm_prime_handle req;
+	req.fd = prime_fd;
+	req.flags = 0;
+	ret = drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &req);
+	if (ret)
+		return ret;
+	if (handle)
+		*handle = req.handle;
+	return 0;
+}
+
 int pscnv_vspace_new(int fd, uint32_t *vid) {
 	int ret;
 	struct drm_pscnv_vspace_req req;
@@ -108,6 +153,10 @@ int pscnv_vspace_free(int fd, uint32_t vid) {
 }
 
 int pscnv_vspace_map(int fd, uint32_t vid, uint32_t handle, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset) {
+	return pscnv_vspace_map_range(fd, vid, handle, 0, 0, start, end, back, flags, offset);
+}
+
+int pscnv_vspace_map_range(int fd, uint32_t vid, uint32_t handle, uint64_t bo_offset, uint64_t length, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset) {
 	int ret;
 	struct drm_pscnv_vspace_map req;
 	req.vid = vid;
@@ -116,6 +165,8 @@ int pscnv_vspace_map(int fd, uint32_t vid, uint32_t handle, uint64_t start, uint
 	req.end = end;
 	req.back = back;
 	req.flags = flags;
+	req.bo_offset = bo_offset;
+	req.length = length;
 	ret = drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_MAP, &req, sizeof(req));
 	if (ret)
 		return ret;
@@ -131,6 +182,44 @@ int pscnv_vspace_unmap(int fd, uint32_t vid, uint64_t offset) {
 	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_UNMAP, &req, sizeof(req));
 }
 
+int pscnv_vspace_bind(int fd, uint32_t vid, struct pscnv_vspace_op *ops, uint32_t num, uint32_t *done) {
+	int ret;
+	struct drm_pscnv_vspace_bind req;
+	/* struct pscnv_vspace_op is laid out like drm_pscnv_vspace_op */
+	req.vid = vid;
+	req.num = num;
+	req.ops = (uintptr_t)ops;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_BIND, &req, sizeof(req));
+	if (done)
+		*done = req.done;
+	return ret;
+}
+
+int pscnv_vspace_reserve(int fd, uint32_t vid, uint64_t size, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset) {
+	int ret;
+	struct drm_pscnv_vspace_reserve req;
+	req.vid = vid;
+	req.flags = flags;
+	req.size = size;
+	req.start = start;
+	req.end = end;
+	req.back = back;
+	req._pad = 0;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_RESERVE, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (offset)
+		*offset = req.offset;
+	return 0;
+}
+
+int pscnv_vspace_release(int fd, uint32_t vid, uint64_t offset) {
+	struct drm_pscnv_vspace_unmap req;
+	req.vid = vid;
+	req.offset = offset;
+	return drmCommandWriteRead(fd, DRM_PSCNV_VSPACE_RELEASE, &req, sizeof(req));
+}
+
 int pscnv_chan_new(int fd, uint32_t vid, uint32_t *cid, uint64_t *map_handle) {
 	int ret;
 	struct drm_pscnv_chan_new req;
@@ -9,6 +9,13 @@
 #define PSCNV_GETPARAM_CHIPSET_ID      11
 #define PSCNV_GETPARAM_GRAPH_UNITS     13
 #define PSCNV_GETPARAM_PTIMER_TIME     14
+/* memory of the calling drm file, and its limits, in bytes */
+#define PSCNV_GETPARAM_CLIENT_VRAM     15
+#define PSCNV_GETPARAM_CLIENT_SYSRAM   16
+#define PSCNV_GETPARAM_CLIENT_PGT      17
+#define PSCNV_GETPARAM_CLIENT_CHAN     18
+#define PSCNV_GETPARAM_CLIENT_SOFT_LIMIT 19
+#define PSCNV_GETPARAM_CLIENT_HARD_LIMIT 20
 
 #define PSCNV_GEM_CONTIG		0x00000001	/* needs to be contiguous in VRAM */
 #define PSCNV_GEM_MAPPABLE		0x00000002	/* intended to be mmapped by host */
@@ -18,17 +25,58 @@
 #define PSCNV_GEM_VRAM_LARGE		0x00000008	/* VRAM with large pages */
 #define PSCNV_GEM_SYSRAM_NOSNOOP	0x0000000c
 #define PSCNV_GEM_GART			PSCNV_GEM_SYSRAM_SNOOP	/* compat */
+#define PSCNV_GEM_LAZY			0x00000020	/* sysram only: pages allocated on first
+							 * CPU touch, GPU sees a dummy page until then */
+#define PSCNV_GEM_USERPTR		0x00000040	/* set by gem_userptr, wraps process memory */
+#define PSCNV_GEM_PRIME			0x00000080	/* set on BOs imported from a dma-buf */
+#define PSCNV_GEM_ZERO			0x00000100	/* gem_new only: clear the BO before
+							 * handing it out */
+#define PSCNV_GEM_READONLY		0x00000200	/* gem_userptr only: pin the pages for
+							 * reading, map them read-only */
+
+/* for pscnv_vspace_bind, which applies the ops in order with a single
+ * TLB flush, stopping at the first that fails */
+#define PSCNV_VSPACE_OP_MAP		1
+#define PSCNV_VSPACE_OP_UNMAP		2
+#define PSCNV_VSPACE_BIND_MAX		0x10000
+struct pscnv_vspace_op {
+	uint32_t op;
+	uint32_t handle;	/* map only */
+	/* map: as for pscnv_vspace_map. unmap: the mapping's offset */
+	uint64_t start;
+	uint64_t end;		/* map only */
+	uint32_t back;		/* map only */
+	uint32_t flags;
+	uint64_t bo_offset;	/* map only, as for pscnv_vspace_map_range */
+	uint64_t length;	/* map only */
+	uint64_t offset;	/* out, map only */
+	int32_t result;		/* out: 0, or the error that stopped the batch */
+	uint32_t _pad;
+};
+
+/* for pscnv_vspace_reserve: unmapped pages of the range point at a
+ * shared dummy page instead of faulting */
+#define PSCNV_VSPACE_RESV_DUMMY		0x00000001
 
 int pscnv_getparam(int fd, uint64_t param, uint64_t *value);
 int pscnv_gem_new(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags, uint64_t size, uint32_t *user, uint32_t *handle, uint64_t *map_handle);
+int pscnv_gem_userptr(int fd, uint32_t cookie, uint32_t flags, void *addr, uint64_t size, uint32_t *handle, uint64_t *map_handle);
 int pscnv_gem_info(int fd, uint32_t handle, uint32_t *cookie, uint32_t *flags, uint32_t *tile_flags, uint64_t *size, uint64_t *map_handle, uint32_t *user);
 int pscnv_gem_close(int fd, uint32_t handle);
 int pscnv_gem_flink(int fd, uint32_t handle, uint32_t *name);
 int pscnv_gem_open(int fd, uint32_t name, uint32_t *handle, uint64_t *size);
+int pscnv_prime_export(int fd, uint32_t handle, int *prime_fd);
+int pscnv_prime_import(int fd, int prime_fd, uint32_t *handle);
 int pscnv_vspace_new(int fd, uint32_t *vid);
 int pscnv_vspace_free(int fd, uint32_t vid);
 int pscnv_vspace_map(int fd, uint32_t vid, uint32_t handle, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
+/* maps length bytes of the BO from bo_offset on, or up to its end with
+ * length 0 */
+int pscnv_vspace_map_range(int fd, uint32_t vid, uint32_t handle, uint64_t bo_offset, uint64_t length, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
 int pscnv_vspace_unmap(int fd, uint32_t vid, uint64_t offset);
+int pscnv_vspace_bind(int fd, uint32_t vid, struct pscnv_vspace_op *ops, uint32_t num, uint32_t *done);
+int pscnv_vspace_reserve(int fd, uint32_t vid, uint64_t size, uint64_t start, uint64_t end, uint32_t back, uint32_t flags, uint64_t *offset);
+int pscnv_vspace_release(int fd, uint32_t vid, uint64_t offset);
 int pscnv_chan_new(int fd, uint32_t vid, uint32_t *cid, uint64_t *map_handle);
 int pscnv_chan_free(int fd, uint32_t cid);
 int pscnv_obj_vdma_new(int fd, uint32_t cid, uint32_t handle, uint32_t oclass, uint32_t flags, uint64_t start, uint64_t size);
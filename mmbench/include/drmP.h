@@ -0,0 +1,76 @@
+/* Hosted stand-in for the kernel/DRM environment pscnv_mm.c is built
+ * against. Only what the allocator actually uses is provided. */
+
+#ifndef __MMBENCH_DRMP_H__
+#define __MMBENCH_DRMP_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+struct drm_device;
+
+#define GFP_KERNEL	0
+
+static inline void *kzalloc(size_t size, int flags) {
+	return calloc(1, size);
+}
+
+static inline void kfree(const void *ptr) {
+	free((void *)ptr);
+}
+
+#define SLAB_DESTROY_BY_RCU	0
+
+#define ACCESS_ONCE(x)	(*(volatile __typeof__(x) *)&(x))
+#define smp_rmb()	__sync_synchronize()
+#define smp_wmb()	__sync_synchronize()
+#define cpu_relax()	do { } while (0)
+
+static inline void rcu_read_lock(void) {
+}
+
+static inline void rcu_read_unlock(void) {
+}
+
+static inline void *vmalloc(unsigned long size) {
+	return malloc(size);
+}
+
+static inline void vfree(const void *ptr) {
+	free((void *)ptr);
+}
+
+struct kmem_cache {
+	size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, unsigned long flags, void (*ctor)(void *)) {
+	struct kmem_cache *res = malloc(sizeof *res);
+	if (res)
+		res->size = size;
+	return res;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache) {
+	free(cache);
+}
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, int flags) {
+	return malloc(cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *ptr) {
+	free(ptr);
+}
+
+#define BUG_ON(x) do {							\
+	if (x) {							\
+		fprintf(stderr, "BUG at %s:%d: %s\n", __FILE__, __LINE__, #x);	\
+		abort();						\
+	}								\
+} while (0)
+
+#endif
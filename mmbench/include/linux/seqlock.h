@@ -0,0 +1,30 @@
+/* Hosted stand-in for the seqcount API. mmbench is single-threaded,
+ * so only the counting is kept. */
+
+#ifndef __MMBENCH_SEQLOCK_H__
+#define __MMBENCH_SEQLOCK_H__
+
+typedef struct seqcount {
+	unsigned sequence;
+} seqcount_t;
+
+static inline void seqcount_init(seqcount_t *s) {
+	s->sequence = 0;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s) {
+	s->sequence++;
+	smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t *s) {
+	smp_wmb();
+	s->sequence++;
+}
+
+static inline int read_seqcount_retry(const seqcount_t *s, unsigned start) {
+	smp_rmb();
+	return s->sequence != start;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __MMBENCH_NOUVEAU_DRV_H__
+#define __MMBENCH_NOUVEAU_DRV_H__
+
+#include "drmP.h"
+
+#define NV_INFO(d, fmt, arg...)  printf("[mm] " fmt, ##arg)
+#define NV_WARN(d, fmt, arg...)  printf("[mm] " fmt, ##arg)
+#define NV_ERROR(d, fmt, arg...) fprintf(stderr, "[mm] " fmt, ##arg)
+
+extern int pscnv_mm_debug;
+
+#endif
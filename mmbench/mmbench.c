@@ -0,0 +1,649 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * Userspace benchmark for the pscnv_mm allocator. Generates or replays
+ * alloc/free traces against a hosted build of pscnv_mm.c and reports
+ * throughput, tree depth and fragmentation.
+ *
+ * Trace format, one op per line, numbers in C notation:
+ *
+ *	a <id> <size> <flags> <start> <end>
+ *	b <id> <count> <size> <flags> <start> <end>
+ *	f <id>
+ *
+ * b allocates ids id..id+count-1 in one pscnv_mm_alloc_batch call.
+ *
+ * With -B, the top of the heap becomes a separate mm with the buddy
+ * backend. Untiled large page allocations try it first, like VRAM heaps
+ * do in the driver, and everything else goes to the rest of the heap.
+ * flags are PSCNV_MM_* bits. Allocations that fail are remembered, and
+ * the matching free is skipped, so a trace can be replayed unchanged
+ * against allocator variants with different failure behaviour.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "pscnv_mm.h"
+
+int pscnv_mm_debug = 0;
+
+#define MMB_BATCH_MAX 16
+
+struct mmb_op {
+	int alloc;
+	int id;
+	/* number of ids allocated in one batch, 1 for plain allocs */
+	int count;
+	uint64_t size;
+	uint32_t flags;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct mmb_class {
+	int weight;
+	uint64_t minsize;
+	uint64_t maxsize;
+	uint32_t flags;
+	/* 0: whole heap, 1: low half only, 2: high half only */
+	int window;
+	/* allocations per batch, 0 for single allocations */
+	int batch;
+};
+
+struct mmb_workload {
+	const char *name;
+	const char *desc;
+	struct mmb_class classes[8];
+};
+
+static struct mmb_workload workloads[] = {
+	{ "small", "4KiB-256KiB BOs, mostly page-table sized", {
+		{ 80, 0x1000, 0x1000, 0, 0 },
+		{ 15, 0x10000, 0x10000, 0, 0 },
+		{ 5, 0x1000, 0x40000, PSCNV_MM_FRAGOK, 0 },
+		{ 0 } } },
+	{ "mixed", "page tables, channel objects, push buffers, big fragmented BOs", {
+		{ 30, 0x1000, 0x1000, 0, 0 },
+		{ 20, 0x10000, 0x10000, 0, 0 },
+		{ 10, 0x100000, 0x100000, 0, 0 },
+		{ 25, 0x10000, 0x400000, PSCNV_MM_FRAGOK, 0 },
+		{ 10, 0x10000, 0x400000, PSCNV_MM_FRAGOK | PSCNV_MM_LP, 0 },
+		{ 5, 0x1000, 0x400000, PSCNV_MM_T1 | PSCNV_MM_FROMBACK | PSCNV_MM_FRAGOK, 0 },
+		{ 0 } } },
+	{ "large", "large-page VRAM, contiguous and fragmented", {
+		{ 50, 0x10000, 0x200000, PSCNV_MM_LP, 0 },
+		{ 50, 0x10000, 0x400000, PSCNV_MM_LP | PSCNV_MM_FRAGOK, 0 },
+		{ 0 } } },
+	{ "vspace", "vspace-style windows and FROMBACK placement", {
+		{ 40, 0x1000, 0x400000, 0, 1 },
+		{ 30, 0x1000, 0x400000, PSCNV_MM_FROMBACK, 2 },
+		{ 20, 0x10000, 0x400000, PSCNV_MM_LP, 0 },
+		{ 10, 0x1000, 0x100000, PSCNV_MM_FROMBACK, 0 },
+		{ 0 } } },
+	{ "ptset", "page tables allocated in batches, next to regular BOs", {
+		{ 40, 0x1000, 0x1000, 0, 0, 4 },
+		{ 20, 0x2000, 0x40000, 0, 0, 2 },
+		{ 30, 0x10000, 0x100000, 0, 0 },
+		{ 10, 0x10000, 0x400000, PSCNV_MM_FRAGOK, 0 },
+		{ 0 } } },
+};
+#define NUM_WORKLOADS (sizeof workloads / sizeof *workloads)
+
+static struct pscnv_mm *mm;
+/* buddy region, see -B */
+static struct pscnv_mm *bmm;
+static uint64_t buddy_size;
+static uint64_t heap_start = 0x40000;
+static uint64_t heap_end = 0x40000000 - 0x20000;
+static uint32_t spsize = 0x1000, lpsize = 0x10000, tssize = 0x18000;
+
+static struct mmb_op *ops;
+static int nops, maxops;
+static struct pscnv_mm_node **live;
+static int maxid;
+
+static uint64_t
+mmb_rand(void)
+{
+	return (uint64_t)random() << 31 | random();
+}
+
+static void
+mmb_add_op(struct mmb_op *op)
+{
+	if (nops == maxops) {
+		maxops = maxops ? maxops * 2 : 0x10000;
+		ops = realloc(ops, maxops * sizeof *ops);
+		if (!ops) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	ops[nops++] = *op;
+	if (op->id + op->count > maxid)
+		maxid = op->id + op->count;
+}
+
+static void
+mmb_generate(struct mmb_workload *wl, int n, int maxlive)
+{
+	int *ids = calloc(maxlive, sizeof *ids);
+	int nlive = 0, nextid = 0, total = 0, maxbatch = 1, i;
+	const struct mmb_class *c;
+	for (c = wl->classes; c->weight; c++) {
+		total += c->weight;
+		if (c->batch > maxbatch)
+			maxbatch = c->batch;
+	}
+	for (i = 0; i < n; i++) {
+		struct mmb_op op = { 0 };
+		if (nlive + maxbatch <= maxlive && (!nlive || random() % 100 < 55)) {
+			int w = random() % total, j;
+			for (c = wl->classes; w >= c->weight; c++)
+				w -= c->weight;
+			op.alloc = 1;
+			op.id = nextid;
+			op.count = c->batch ? c->batch : 1;
+			nextid += op.count;
+			op.size = c->minsize;
+			if (c->maxsize > c->minsize)
+				op.size += mmb_rand() % (c->maxsize - c->minsize);
+			op.flags = c->flags;
+			op.start = heap_start;
+			op.end = heap_end;
+			if (c->window == 1)
+				op.end = heap_start + (heap_end - heap_start) / 2;
+			else if (c->window == 2)
+				op.start = heap_start + (heap_end - heap_start) / 2;
+			for (j = 0; j < op.count; j++)
+				ids[nlive++] = op.id + j;
+		} else {
+			int j = random() % nlive;
+			op.id = ids[j];
+			ids[j] = ids[--nlive];
+		}
+		mmb_add_op(&op);
+	}
+	free(ids);
+}
+
+static int
+mmb_load(const char *fname)
+{
+	char line[256];
+	FILE *f = fopen(fname, "r");
+	if (!f) {
+		perror(fname);
+		return -1;
+	}
+	while (fgets(line, sizeof line, f)) {
+		struct mmb_op op = { 0 };
+		unsigned long long size, start, end;
+		unsigned flags;
+		op.count = 1;
+		if ((line[0] == 'a' && sscanf(line + 1, "%d %lli %i %lli %lli", &op.id, &size, &flags, &start, &end) == 5) ||
+		    (line[0] == 'b' && sscanf(line + 1, "%d %d %lli %i %lli %lli", &op.id, &op.count, &size, &flags, &start, &end) == 6)) {
+			op.alloc = 1;
+			op.size = size;
+			op.flags = flags;
+			op.start = start;
+			op.end = end;
+		} else if (line[0] == 'f' && sscanf(line + 1, "%d", &op.id) == 1) {
+			op.alloc = 0;
+		} else if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		} else {
+			fprintf(stderr, "%s: bad trace line: %s", fname, line);
+			fclose(f);
+			return -1;
+		}
+		if (op.count < 1 || op.count > MMB_BATCH_MAX) {
+			fprintf(stderr, "%s: bad batch count %d\n", fname, op.count);
+			fclose(f);
+			return -1;
+		}
+		if (op.id < 0) {
+			fprintf(stderr, "%s: bad id %d\n", fname, op.id);
+			fclose(f);
+			return -1;
+		}
+		mmb_add_op(&op);
+	}
+	fclose(f);
+	return 0;
+}
+
+static int
+mmb_save(const char *fname)
+{
+	FILE *f = fopen(fname, "w");
+	int i;
+	if (!f) {
+		perror(fname);
+		return -1;
+	}
+	for (i = 0; i < nops; i++) {
+		if (ops[i].alloc && ops[i].count > 1)
+			fprintf(f, "b %d %d %#llx %#x %#llx %#llx\n", ops[i].id,
+					ops[i].count, (unsigned long long)ops[i].size,
+					ops[i].flags, (unsigned long long)ops[i].start,
+					(unsigned long long)ops[i].end);
+		else if (ops[i].alloc)
+			fprintf(f, "a %d %#llx %#x %#llx %#llx\n", ops[i].id,
+					(unsigned long long)ops[i].size, ops[i].flags,
+					(unsigned long long)ops[i].start,
+					(unsigned long long)ops[i].end);
+		else
+			fprintf(f, "f %d\n", ops[i].id);
+	}
+	fclose(f);
+	return 0;
+}
+
+static int
+mmb_depth(struct pscnv_mm_node *node)
+{
+	int l, r;
+	if (!node)
+		return 0;
+	l = mmb_depth(PSCNV_RB_LEFT(node, entry));
+	r = mmb_depth(PSCNV_RB_RIGHT(node, entry));
+	return 1 + (l > r ? l : r);
+}
+
+struct mmb_walk {
+	struct pscnv_mm *mm;
+	struct pscnv_mm_node *prev;
+	int nodes;
+	int freenodes;
+	int cachednodes;
+	uint64_t freebytes;
+	int errors;
+};
+
+static void
+mmb_check_node(struct pscnv_mm_node *node, struct mmb_walk *w)
+{
+	struct pscnv_mm_node *left, *right;
+	int i;
+	if (!node)
+		return;
+	left = PSCNV_RB_LEFT(node, entry);
+	right = PSCNV_RB_RIGHT(node, entry);
+	mmb_check_node(left, w);
+
+	for (i = 0; i < 4; i++) {
+		uint64_t mg = node->gap[i];
+		if (left && left->maxgap[i] > mg)
+			mg = left->maxgap[i];
+		if (right && right->maxgap[i] > mg)
+			mg = right->maxgap[i];
+		if (mg != node->maxgap[i]) {
+			fprintf(stderr, "node %llx: maxgap[%d] %llx, expected %llx\n",
+					(unsigned long long)node->start, i,
+					(unsigned long long)node->maxgap[i],
+					(unsigned long long)mg);
+			w->errors++;
+		}
+		if (node->gap[i] > node->size) {
+			fprintf(stderr, "node %llx: gap[%d] %llx larger than node\n",
+					(unsigned long long)node->start, i,
+					(unsigned long long)node->gap[i]);
+			w->errors++;
+		}
+		if (node->type != PSCNV_MM_TYPE_FREE && node->gap[i]) {
+			fprintf(stderr, "node %llx: used node with gap\n",
+					(unsigned long long)node->start);
+			w->errors++;
+		}
+	}
+	if (w->prev) {
+		if (w->prev->start + w->prev->size != node->start) {
+			fprintf(stderr, "node %llx: not adjacent to %llx..%llx\n",
+					(unsigned long long)node->start,
+					(unsigned long long)w->prev->start,
+					(unsigned long long)(w->prev->start + w->prev->size));
+			w->errors++;
+		}
+		if (w->prev->type == PSCNV_MM_TYPE_FREE && node->type == PSCNV_MM_TYPE_FREE) {
+			fprintf(stderr, "node %llx: unmerged free neighbours\n",
+					(unsigned long long)node->start);
+			w->errors++;
+		}
+	}
+	if (!node->sentinel) {
+		struct pscnv_mm_node snap;
+		uint64_t last = node->start + node->size - 1;
+		if (pscnv_mm_lookup(w->mm, node->start, &snap) || snap.start != node->start ||
+				pscnv_mm_lookup(w->mm, last, &snap) || snap.start != node->start) {
+			fprintf(stderr, "node %llx: lockless lookup disagrees\n",
+					(unsigned long long)node->start);
+			w->errors++;
+		}
+		w->nodes++;
+		if (node->type == PSCNV_MM_TYPE_FREE) {
+			w->freenodes++;
+			w->freebytes += node->size;
+		}
+		if (node->cached)
+			w->cachednodes++;
+	}
+	w->prev = node;
+
+	mmb_check_node(right, w);
+}
+
+static int
+mmb_walk(struct pscnv_mm *mm, struct mmb_walk *w)
+{
+	struct pscnv_mm_info info;
+	uint64_t bfree = 0;
+	int i;
+	memset(w, 0, sizeof *w);
+	w->mm = mm;
+	mmb_check_node(PSCNV_RB_ROOT(&mm->head), w);
+	if (w->cachednodes != mm->ncached) {
+		fprintf(stderr, "%d cached nodes in tree, %d on free lists\n",
+				w->cachednodes, mm->ncached);
+		w->errors++;
+	}
+	pscnv_mm_get_info(mm, &info);
+	if (info.nodes != w->nodes || info.freenodes != w->freenodes ||
+			info.cachednodes != w->cachednodes || info.freebytes != w->freebytes) {
+		fprintf(stderr, "pscnv_mm_get_info disagrees with the tree\n");
+		w->errors++;
+	}
+	/* the buddy region is large page aligned, so it's all in blocks */
+	for (i = 0; i < PSCNV_MM_BUDDY_ORDERS; i++)
+		bfree += (uint64_t)info.buddy[i] * lpsize << i;
+	if (mm == bmm && bfree != w->freebytes) {
+		fprintf(stderr, "buddy blocks hold 0x%llx free bytes, the tree 0x%llx\n",
+				(unsigned long long)bfree, (unsigned long long)w->freebytes);
+		w->errors++;
+	}
+	if (mmb_depth(PSCNV_RB_ROOT(&mm->head)) > PSCNV_MM_LOOKUP_DEPTH) {
+		fprintf(stderr, "tree deeper than lockless lookups walk\n");
+		w->errors++;
+	}
+	return w->errors;
+}
+
+static int check;
+
+static int
+mmb_alloc_in(struct pscnv_mm *m, struct mmb_op *op, const uint64_t *sizes, struct pscnv_mm_node **nodes)
+{
+	if (op->count > 1)
+		return pscnv_mm_alloc_batch(m, op->count, sizes, op->flags, op->start, op->end, nodes);
+	return pscnv_mm_alloc(m, op->size, op->flags, op->start, op->end, nodes);
+}
+
+static int
+mmb_alloc(struct mmb_op *op, const uint64_t *sizes, struct pscnv_mm_node **nodes)
+{
+	if (bmm && (op->flags & PSCNV_MM_LP) && !(op->flags & PSCNV_MM_T1) &&
+			!mmb_alloc_in(bmm, op, sizes, nodes))
+		return 0;
+	return mmb_alloc_in(mm, op, sizes, nodes);
+}
+
+static int
+mmb_replay(double *elapsed, int *nalloc, int *nfree, int *nfail)
+{
+	struct timespec t0, t1;
+	struct mmb_walk w;
+	double total = 0;
+	int i;
+	*nalloc = *nfree = *nfail = 0;
+	live = calloc(maxid, sizeof *live);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nops; i++) {
+		struct mmb_op *op = &ops[i];
+		if (op->alloc) {
+			struct pscnv_mm_node *nodes[MMB_BATCH_MAX], *n;
+			uint64_t sizes[MMB_BATCH_MAX];
+			int j;
+			for (j = 0; j < op->count; j++) {
+				if (live[op->id + j]) {
+					fprintf(stderr, "op %d: id %d allocated twice\n", i, op->id + j);
+					return -1;
+				}
+				sizes[j] = op->size;
+			}
+			(*nalloc) += op->count;
+			if (mmb_alloc(op, sizes, nodes)) {
+				(*nfail) += op->count;
+				continue;
+			}
+			for (j = 0; j < op->count; j++) {
+				uint64_t got = 0;
+				live[op->id + j] = nodes[j];
+				if (!check)
+					continue;
+				for (n = nodes[j]; n; n = n->next) {
+					if (n->start < op->start || n->start + n->size > op->end) {
+						fprintf(stderr, "op %d: node %llx..%llx outside window\n", i,
+								(unsigned long long)n->start,
+								(unsigned long long)(n->start + n->size));
+						return -1;
+					}
+					got += n->size;
+				}
+				if (got < op->size || (nodes[j]->next && !(op->flags & PSCNV_MM_FRAGOK))) {
+					fprintf(stderr, "op %d: bad allocation of %llx bytes\n", i,
+							(unsigned long long)got);
+					return -1;
+				}
+			}
+		} else {
+			if (!live[op->id])
+				continue;
+			(*nfree)++;
+			pscnv_mm_free(live[op->id]);
+			live[op->id] = 0;
+		}
+		if (check) {
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			total += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+			if (mmb_walk(mm, &w) || (bmm && mmb_walk(bmm, &w))) {
+				fprintf(stderr, "op %d: tree inconsistent\n", i);
+				return -1;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	total += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	*elapsed = total;
+	return 0;
+}
+
+static void
+mmb_report_counters(struct pscnv_mm *mm)
+{
+	printf("allocs %llu, frees %llu, fails %llu, splits %llu, merges %llu, cache hits %llu\n",
+			(unsigned long long)mm->stats.allocs, (unsigned long long)mm->stats.frees,
+			(unsigned long long)mm->stats.fails, (unsigned long long)mm->stats.splits,
+			(unsigned long long)mm->stats.merges, (unsigned long long)mm->stats.cache_hits);
+}
+
+static void
+mmb_report_buddy(void)
+{
+	struct pscnv_mm_info info;
+	int i;
+	pscnv_mm_flush_cache(bmm);
+	pscnv_mm_get_info(bmm, &info);
+	printf("buddy region 0x%llx bytes: nodes %d (%d free)\n",
+			(unsigned long long)buddy_size, info.nodes, info.freenodes);
+	mmb_report_counters(bmm);
+	printf("free 0x%llx bytes, largest LP 0x%llx, free blocks per order:",
+			(unsigned long long)info.freebytes,
+			(unsigned long long)info.largest[PSCNV_MM_LP]);
+	for (i = 0; i < PSCNV_MM_BUDDY_ORDERS; i++)
+		printf(" %d", info.buddy[i]);
+	printf("\n");
+}
+
+static void
+mmb_report(const char *name, double elapsed, int nalloc, int nfree, int nfail)
+{
+	struct pscnv_mm_node *root = PSCNV_RB_ROOT(&mm->head);
+	struct mmb_walk w;
+	int i;
+	mmb_walk(mm, &w);
+	printf("trace %s: %d ops (%d allocs, %d frees, %d failed)\n",
+			name, nops, nalloc, nfree, nfail);
+	printf("time %.3fs, %.0f ops/sec\n", elapsed,
+			elapsed > 0 ? (nalloc + nfree) / elapsed : 0.0);
+	printf("nodes %d (%d free, %d cached), tree depth %d\n",
+			w.nodes, w.freenodes, w.cachednodes, mmb_depth(root));
+	mmb_report_counters(mm);
+	/* cached nodes are free space as far as fragmentation goes */
+	pscnv_mm_flush_cache(mm);
+	root = PSCNV_RB_ROOT(&mm->head);
+	mmb_walk(mm, &w);
+	printf("free 0x%llx bytes of 0x%llx\n", (unsigned long long)w.freebytes,
+			(unsigned long long)(heap_end - heap_start - buddy_size));
+	for (i = 0; i < 4; i++)
+		printf("gap type %d:%s%s largest 0x%llx, fragmentation %.1f%%\n", i,
+				(i & PSCNV_MM_T1 ? " T1" : ""),
+				(i & PSCNV_MM_LP ? " LP" : ""),
+				(unsigned long long)root->maxgap[i],
+				w.freebytes ? 100.0 * (1.0 - (double)root->maxgap[i] / w.freebytes) : 0.0);
+	if (bmm)
+		mmb_report_buddy();
+}
+
+static void
+usage(const char *prog)
+{
+	int i;
+	fprintf(stderr, "Usage: %s [options]\n"
+			"  -w name   workload to generate (default mixed)\n"
+			"  -n ops    number of ops to generate (default 1000000)\n"
+			"  -l live   max live allocations (default 400)\n"
+			"  -s seed   random seed (default 1)\n"
+			"  -r file   replay trace from file instead of generating\n"
+			"  -o file   save the trace to file\n"
+			"  -H size   heap size (default 0x40000000)\n"
+			"  -t size   tile switch granularity (default 0x18000)\n"
+			"  -p policy allocation policy, first or best (default first)\n"
+			"  -B size   put untiled large pages in a buddy region of this size\n"
+			"  -c        check tree consistency after every op\n"
+			"  -d level  pscnv_mm debug level\n"
+			"workloads:\n", prog);
+	for (i = 0; i < NUM_WORKLOADS; i++)
+		fprintf(stderr, "  %-8s  %s\n", workloads[i].name, workloads[i].desc);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *wlname = "mixed", *rfile = 0, *ofile = 0;
+	int n = 1000000, maxlive = 400, seed = 1;
+	int nalloc, nfree, nfail, c, i;
+	double elapsed;
+	struct mmb_workload *wl = 0;
+	uint32_t policy = 0;
+
+	while ((c = getopt(argc, argv, "w:n:l:s:r:o:H:t:p:B:cd:")) != -1) {
+		switch (c) {
+		case 'w': wlname = optarg; break;
+		case 'n': n = strtol(optarg, 0, 0); break;
+		case 'l': maxlive = strtol(optarg, 0, 0); break;
+		case 's': seed = strtol(optarg, 0, 0); break;
+		case 'r': rfile = optarg; break;
+		case 'o': ofile = optarg; break;
+		case 'H': heap_end = strtoull(optarg, 0, 0) - 0x20000; break;
+		case 't': tssize = strtoul(optarg, 0, 0); break;
+		case 'p':
+			if (!strcmp(optarg, "best"))
+				policy = PSCNV_MM_BESTFIT;
+			else if (strcmp(optarg, "first"))
+				usage(argv[0]);
+			break;
+		case 'B': buddy_size = strtoull(optarg, 0, 0); break;
+		case 'c': check = 1; break;
+		case 'd': pscnv_mm_debug = strtol(optarg, 0, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (heap_end <= heap_start || !tssize || maxlive < MMB_BATCH_MAX)
+		usage(argv[0]);
+	/* keep the split on both a large page and a tile switch boundary,
+	 * as pscnv_vram_heaps_init does */
+	if (buddy_size) {
+		uint64_t align = lpsize, split;
+		while (align % tssize)
+			align += lpsize;
+		split = (heap_end - buddy_size) / align * align;
+		if (split <= heap_start)
+			usage(argv[0]);
+		buddy_size = heap_end - split;
+	}
+
+	if (rfile) {
+		if (mmb_load(rfile))
+			return 1;
+	} else {
+		for (i = 0; i < NUM_WORKLOADS; i++)
+			if (!strcmp(workloads[i].name, wlname))
+				wl = &workloads[i];
+		if (!wl)
+			usage(argv[0]);
+		srandom(seed);
+		mmb_generate(wl, n, maxlive);
+	}
+	if (ofile && mmb_save(ofile))
+		return 1;
+
+	if (pscnv_mm_cache_init()) {
+		fprintf(stderr, "pscnv_mm_cache_init failed\n");
+		return 1;
+	}
+	if (pscnv_mm_init(0, heap_start, heap_end - buddy_size, spsize, lpsize, tssize, &mm)) {
+		fprintf(stderr, "pscnv_mm_init failed\n");
+		return 1;
+	}
+	mm->policy = policy;
+	if (buddy_size && pscnv_mm_init_buddy(0, heap_end - buddy_size, heap_end, spsize, lpsize, tssize, &bmm)) {
+		fprintf(stderr, "pscnv_mm_init_buddy failed\n");
+		return 1;
+	}
+	if (mmb_replay(&elapsed, &nalloc, &nfree, &nfail))
+		return 1;
+	mmb_report(rfile ? rfile : wlname, elapsed, nalloc, nfree, nfail);
+	if (check)
+		printf("consistency checks passed\n");
+	return 0;
+}
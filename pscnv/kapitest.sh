@@ -1,5 +1,5 @@
 #!/bin/sh
-TESTS="gamma_set_5 gamma_set_6 drm_ioctl_def drm_ioctl_def_drv drm_connector_detect_1 drm_connector_detect_2"
+TESTS="gamma_set_5 gamma_set_6 drm_ioctl_def drm_ioctl_def_drv drm_connector_detect_1 drm_connector_detect_2 drm_gem_prime"
 
 make -k -C $1 M=$PWD/kapitest clean >&2
 make -k -C $1 M=$PWD/kapitest modules >&2
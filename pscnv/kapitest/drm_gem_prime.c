@@ -0,0 +1,13 @@
+#include "drm.h"
+#include "drmP.h"
+#include <linux/dma-buf.h>
+
+static struct dma_buf_ops ops;
+
+void dummy(struct drm_driver *driver, struct drm_gem_object *obj) {
+	driver->prime_handle_to_fd = drm_gem_prime_handle_to_fd;
+	driver->prime_fd_to_handle = drm_gem_prime_fd_to_handle;
+	driver->gem_prime_import = 0;
+	obj->import_attach = 0;
+	dma_buf_export(obj, &ops, obj->size, 0);
+}
@@ -33,6 +33,8 @@
 #include "drmP.h"
 #include "nouveau_drv.h"
 #include "nouveau_reg.h"
+#include "pscnv_vm.h"
+#include "pscnv_client.h"
 
 #if 0
 static int
@@ -145,6 +147,254 @@ nouveau_debugfs_memory_info(struct seq_file *m, void *data)
 	return 0;
 }
 
+/* distinct BO cookies tracked per mm, the rest is lumped together */
+#define NOUVEAU_DEBUGFS_COOKIES 32
+
+struct nouveau_debugfs_cookie {
+	uint32_t cookie;
+	int bos;
+	uint64_t bytes;
+};
+
+/* Prints the layout of one mm. The caller holds its lock, which keeps
+ * the BOs tagged on its used nodes alive. */
+static void
+nouveau_debugfs_mm_show(struct seq_file *m, struct pscnv_mm *mm)
+{
+	struct nouveau_debugfs_cookie *cookies;
+	struct pscnv_mm_node *node, *head;
+	struct pscnv_mm_info info;
+	struct pscnv_bo *bo;
+	int ncookies = 0, i, j;
+
+	pscnv_mm_get_info(mm, &info);
+	seq_printf(m, "nodes %d, %d free, %d cached, free %lldKiB\n",
+		   info.nodes, info.freenodes, info.cachednodes, info.freebytes >> 10);
+	for (i = 0; i < 4; i++) {
+		seq_printf(m, "gap type %d%s%s: largest %lldKiB, histogram",
+			   i, (i & PSCNV_MM_T1 ? " T1" : ""), (i & PSCNV_MM_LP ? " LP" : ""),
+			   info.largest[i] >> 10);
+		for (j = 0; j < PSCNV_MM_HIST_BUCKETS; j++)
+			seq_printf(m, " %d", info.hist[i][j]);
+		seq_printf(m, "\n");
+	}
+	if (mm->backend_priv) {
+		seq_printf(m, "%s free blocks per order:", mm->backend->name);
+		for (j = 0; j < PSCNV_MM_BUDDY_ORDERS; j++)
+			seq_printf(m, " %d", info.buddy[j]);
+		seq_printf(m, "\n");
+	}
+
+	/* one extra slot for cookies that didn't fit */
+	cookies = kcalloc(NOUVEAU_DEBUGFS_COOKIES + 1, sizeof *cookies, GFP_KERNEL);
+	if (!cookies)
+		return;
+	for (node = pscnv_mm_first(mm); node; node = pscnv_mm_next(node)) {
+		if (node->type == PSCNV_MM_TYPE_FREE || node->cached)
+			continue;
+		head = node;
+		while (head->prev)
+			head = head->prev;
+		bo = head->tag;
+		if (!bo)
+			continue;
+		for (i = 0; i < ncookies; i++)
+			if (cookies[i].cookie == bo->cookie)
+				break;
+		if (i == ncookies && ncookies < NOUVEAU_DEBUGFS_COOKIES)
+			cookies[ncookies++].cookie = bo->cookie;
+		if (node == head)
+			cookies[i].bos++;
+		cookies[i].bytes += node->size;
+	}
+	for (i = 0; i <= NOUVEAU_DEBUGFS_COOKIES; i++) {
+		if (!cookies[i].bos)
+			continue;
+		if (i == NOUVEAU_DEBUGFS_COOKIES)
+			seq_printf(m, "cookie    other: ");
+		else
+			seq_printf(m, "cookie %08x: ", cookies[i].cookie);
+		seq_printf(m, "%d BOs, %lldKiB\n", cookies[i].bos, cookies[i].bytes >> 10);
+	}
+	kfree(cookies);
+}
+
+static void
+nouveau_debugfs_mm_counters(struct seq_file *m, struct pscnv_mm *mm)
+{
+	struct pscnv_mm_stats *st = &mm->stats;
+	seq_printf(m, "allocs %lld, frees %lld, fails %lld, splits %lld, merges %lld, cache hits %lld\n",
+		   st->allocs, st->frees, st->fails, st->splits, st->merges, st->cache_hits);
+}
+
+static int
+nouveau_debugfs_vram_mm(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+	struct pscnv_vram_heap *heap;
+	int i;
+
+	for (i = 0; i < dev_priv->vram_nheaps; i++) {
+		heap = &dev_priv->vram_heaps[i];
+		seq_printf(m, "heap %d: %llx-%llx\n", i, heap->start, heap->end);
+		mutex_lock(&heap->lock);
+		nouveau_debugfs_mm_show(m, heap->mm);
+		mutex_unlock(&heap->lock);
+	}
+	return 0;
+}
+
+static int
+nouveau_debugfs_vspace_mm(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vspace *vs;
+	int i;
+
+	if (!dev_priv->vm_ok)
+		return 0;
+	for (i = -3; i < 128; i++) {
+		if (!i || !(vs = pscnv_vspace_get(dev, i)))
+			continue;
+		seq_printf(m, "vspace %d:\n", i);
+		mutex_lock(&vs->lock);
+		nouveau_debugfs_mm_show(m, vs->mm);
+		mutex_unlock(&vs->lock);
+		pscnv_vspace_unref(vs);
+	}
+	return 0;
+}
+
+static int
+nouveau_debugfs_mm_counters_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vspace *vs;
+	int i;
+
+	/* unlocked: counters may be a little stale, but never torn on 64-bit */
+	for (i = 0; i < dev_priv->vram_nheaps; i++) {
+		seq_printf(m, "vram heap %d: ", i);
+		nouveau_debugfs_mm_counters(m, dev_priv->vram_heaps[i].mm);
+	}
+	if (!dev_priv->vm_ok)
+		return 0;
+	for (i = -3; i < 128; i++) {
+		if (!i || !(vs = pscnv_vspace_get(dev, i)))
+			continue;
+		seq_printf(m, "vspace %d: ", i);
+		nouveau_debugfs_mm_counters(m, vs->mm);
+		pscnv_vspace_unref(vs);
+	}
+	return 0;
+}
+
+/* vram_compact: reading shows the largest free VRAM range, and how many
+ * BOs the last compaction run started from here moved. Writing anything
+ * runs a full compaction pass. Compaction copies BOs through PRAMIN
+ * without waiting for the card, so whoever writes must make sure the
+ * card is idle and nothing has the movable BOs mmapped meanwhile. */
+static int
+nouveau_debugfs_vram_compact_show(struct seq_file *m, void *data)
+{
+	struct drm_device *dev = m->private;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t largest = pscnv_vram_largest(dev);
+
+	seq_printf(m, "moved BOs   : %d\n", dev_priv->vram_compact_moved);
+	seq_printf(m, "largest free: %dKiB\n", (int)(largest >> 10));
+	return 0;
+}
+
+static int
+nouveau_debugfs_vram_compact_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nouveau_debugfs_vram_compact_show,
+			   inode->i_private);
+}
+
+static ssize_t
+nouveau_debugfs_vram_compact_write(struct file *file, const char __user *buf,
+				   size_t len, loff_t *ppos)
+{
+	struct drm_device *dev = ((struct seq_file *)file->private_data)->private;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int ret;
+
+	ret = pscnv_vram_compact(dev, 0);
+	if (ret < 0)
+		return ret;
+	dev_priv->vram_compact_moved = ret;
+	return len;
+}
+
+static const struct file_operations nouveau_debugfs_vram_compact_fops = {
+	.owner = THIS_MODULE,
+	.open = nouveau_debugfs_vram_compact_open,
+	.read = seq_read,
+	.write = nouveau_debugfs_vram_compact_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int
+nouveau_debugfs_vram_evict(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+
+	mutex_lock(&dev_priv->vram_compact_mutex);
+	seq_printf(m, "evictions: %lld, %lldKiB\n", dev_priv->vram_evictions,
+		   dev_priv->vram_evicted_bytes >> 10);
+	seq_printf(m, "restores : %lld, %lldKiB\n", dev_priv->vram_restores,
+		   dev_priv->vram_restored_bytes >> 10);
+	mutex_unlock(&dev_priv->vram_compact_mutex);
+	return 0;
+}
+
+static int
+nouveau_debugfs_clients(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+	struct pscnv_client *client;
+	struct pscnv_client_usage usage;
+
+	seq_printf(m, "%8s %-16s %10s %10s %8s %8s %10s %10s\n", "pid", "comm",
+		   "vram", "sysram", "pgt", "chan", "soft", "hard");
+	mutex_lock(&dev_priv->clients_lock);
+	list_for_each_entry(client, &dev_priv->clients, head) {
+		pscnv_client_usage(client, &usage);
+		seq_printf(m, "%8d %-16s %8lldKi %8lldKi %6lldKi %6lldKi %8lldMi %8lldMi\n",
+			   client->pid, client->comm, usage.vram >> 10, usage.sysram >> 10,
+			   usage.pgt >> 10, usage.chan >> 10,
+			   client->soft_limit >> 20, client->hard_limit >> 20);
+	}
+	mutex_unlock(&dev_priv->clients_lock);
+	return 0;
+}
+
+static int
+nouveau_debugfs_bo_cache(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *) m->private;
+	struct drm_nouveau_private *dev_priv = node->minor->dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+
+	mutex_lock(&cache->lock);
+	seq_printf(m, "cached BOs  : %d, %lldKiB\n", cache->num, cache->bytes >> 10);
+	seq_printf(m, "sysram pages: %d\n", cache->sysram_pages);
+	seq_printf(m, "hits %lld, misses %lld, expired %lld, evicted %lld, reclaimed %lld\n",
+		   cache->hits, cache->misses, cache->expired, cache->evicted, cache->reclaimed);
+	mutex_unlock(&cache->lock);
+	return 0;
+}
+
 static int
 nouveau_debugfs_vbios_image(struct seq_file *m, void *data)
 {
@@ -161,20 +411,41 @@ static struct drm_info_list nouveau_debugfs_list[] = {
 	{ "chipset", nouveau_debugfs_chipset_info, 0, NULL },
 	{ "memory", nouveau_debugfs_memory_info, 0, NULL },
 	{ "vbios.rom", nouveau_debugfs_vbios_image, 0, NULL },
+	{ "bo_cache", nouveau_debugfs_bo_cache, 0, NULL },
+	{ "clients", nouveau_debugfs_clients, 0, NULL },
+	{ "vram_evict", nouveau_debugfs_vram_evict, 0, NULL },
+	{ "vram_mm", nouveau_debugfs_vram_mm, 0, NULL },
+	{ "vspace_mm", nouveau_debugfs_vspace_mm, 0, NULL },
+	{ "mm_counters", nouveau_debugfs_mm_counters_info, 0, NULL },
 };
 #define NOUVEAU_DEBUGFS_ENTRIES ARRAY_SIZE(nouveau_debugfs_list)
 
 int
 nouveau_debugfs_init(struct drm_minor *minor)
 {
+	struct drm_nouveau_private *dev_priv = minor->dev->dev_private;
+
 	drm_debugfs_create_files(nouveau_debugfs_list, NOUVEAU_DEBUGFS_ENTRIES,
 				 minor->debugfs_root, minor);
+	/* writable, so not a drm_info_list entry. once per device */
+	if (minor->type != DRM_MINOR_CONTROL && !dev_priv->debugfs.vram_compact)
+		dev_priv->debugfs.vram_compact =
+			debugfs_create_file("vram_compact", S_IRUGO | S_IWUSR,
+					    minor->debugfs_root, minor->dev,
+					    &nouveau_debugfs_vram_compact_fops);
 	return 0;
 }
 
 void
 nouveau_debugfs_takedown(struct drm_minor *minor)
 {
+	struct drm_nouveau_private *dev_priv = minor->dev->dev_private;
+
 	drm_debugfs_remove_files(nouveau_debugfs_list, NOUVEAU_DEBUGFS_ENTRIES,
 				 minor);
+	if (dev_priv->debugfs.vram_compact &&
+	    dev_priv->debugfs.vram_compact->d_parent == minor->debugfs_root) {
+		debugfs_remove(dev_priv->debugfs.vram_compact);
+		dev_priv->debugfs.vram_compact = NULL;
+	}
 }
@@ -34,6 +34,7 @@
 #include "nouveau_pm.h"
 #include "pscnv_gem.h"
 #include "pscnv_vm.h"
+#include "pscnv_client.h"
 #if 0
 #include "nouveau_hw.h"
 #include "nouveau_fb.h"
@@ -44,6 +45,10 @@
 #include "drm_pciids.h"
 #include "pscnv_kapi.h"
 
+#if DRIVER_PATCHLEVEL != PSCNV_DRM_HEADER_PATCHLEVEL
+#error "pscnv_drm.h and the driver patchlevel disagree"
+#endif
+
 MODULE_PARM_DESC(agpmode, "AGP mode (0 to disable AGP)");
 int nouveau_agpmode = -1;
 module_param_named(agpmode, nouveau_agpmode, int, 0400);
@@ -127,6 +132,42 @@ MODULE_PARM_DESC(vm_debug, "VM debug level: 0-2.");
 int pscnv_vm_debug = 0;
 module_param_named(vm_debug, pscnv_vm_debug, int, 0400);
 
+MODULE_PARM_DESC(vram_compact, "Compact VRAM and retry when a BO or channel allocation fails: 0-1.");
+int pscnv_vram_compact_on_fail = 0;
+module_param_named(vram_compact, pscnv_vram_compact_on_fail, int, 0600);
+
+MODULE_PARM_DESC(vram_evict, "Evict least recently mapped BOs to system memory and retry when a BO allocation fails: 0-1.");
+int pscnv_vram_evict_on_fail = 0;
+module_param_named(vram_evict, pscnv_vram_evict_on_fail, int, 0600);
+
+MODULE_PARM_DESC(vram_heaps, "Number of independently locked VRAM heaps, 0 for one per memory partition up to the CPU count.");
+int pscnv_vram_heaps = 0;
+module_param_named(vram_heaps, pscnv_vram_heaps, int, 0400);
+
+MODULE_PARM_DESC(vram_lp_buddy, "MiB at the top of VRAM kept for untiled large page BOs, placed by a buddy allocator. 0 to disable.");
+int pscnv_vram_lp_buddy = 0;
+module_param_named(vram_lp_buddy, pscnv_vram_lp_buddy, int, 0400);
+
+MODULE_PARM_DESC(bo_cache, "MiB of freed BOs kept for reuse, per device. 0 to disable.");
+int pscnv_bo_cache_size = 32;
+module_param_named(bo_cache, pscnv_bo_cache_size, int, 0400);
+
+MODULE_PARM_DESC(sysram_fault_around, "Pages mapped per CPU fault on sysram BOs, rounded down to a power of two, up to 512.");
+int pscnv_sysram_fault_around = 16;
+module_param_named(sysram_fault_around, pscnv_sysram_fault_around, int, 0600);
+
+MODULE_PARM_DESC(sysram_prefault, "Map all present pages of sysram BOs at mmap time.");
+int pscnv_sysram_prefault = 0;
+module_param_named(sysram_prefault, pscnv_sysram_prefault, int, 0600);
+
+MODULE_PARM_DESC(client_soft_limit, "MiB of BOs a drm file can have before its allocations stop compacting or evicting VRAM. 0 for no limit.");
+int pscnv_client_soft_limit = 0;
+module_param_named(client_soft_limit, pscnv_client_soft_limit, int, 0600);
+
+MODULE_PARM_DESC(client_hard_limit, "MiB of BOs a drm file can have at most. 0 for no limit.");
+int pscnv_client_hard_limit = 0;
+module_param_named(client_hard_limit, pscnv_client_hard_limit, int, 0600);
+
 MODULE_PARM_DESC(ramht_debug, "RAMHT debug level: 0-2.");
 int pscnv_ramht_debug = 0;
 module_param_named(ramht_debug, pscnv_ramht_debug, int, 0400);
@@ -412,12 +453,18 @@ nouveau_pci_resume(struct pci_dev *pdev)
 static struct drm_driver driver = {
 	.driver_features =
 		DRIVER_USE_AGP | DRIVER_PCI_DMA | DRIVER_SG |
-		DRIVER_HAVE_IRQ | DRIVER_IRQ_SHARED | DRIVER_GEM,
+		DRIVER_HAVE_IRQ | DRIVER_IRQ_SHARED | DRIVER_GEM
+#ifdef PSCNV_KAPI_DRM_GEM_PRIME
+		| DRIVER_PRIME
+#endif
+		,
 	.load = nouveau_load,
 	.firstopen = nouveau_firstopen,
 	.lastclose = nouveau_lastclose,
 	.unload = nouveau_unload,
+	.open = pscnv_client_open,
 	.preclose = nouveau_preclose,
+	.postclose = pscnv_client_postclose,
 #if defined(CONFIG_DRM_NOUVEAU_DEBUG)
 	.debugfs_init = nouveau_debugfs_init,
 	.debugfs_cleanup = nouveau_debugfs_takedown,
@@ -452,6 +499,12 @@ static struct drm_driver driver = {
 	},
 
 	.gem_free_object = pscnv_gem_free_object,
+#ifdef PSCNV_KAPI_DRM_GEM_PRIME
+	.prime_handle_to_fd = drm_gem_prime_handle_to_fd,
+	.prime_fd_to_handle = drm_gem_prime_fd_to_handle,
+	.gem_prime_export = pscnv_gem_prime_export,
+	.gem_prime_import = pscnv_gem_prime_import,
+#endif
 
 	.name = DRIVER_NAME,
 	.desc = DRIVER_DESC,
@@ -467,6 +520,8 @@ static struct drm_driver driver = {
 
 static int __init nouveau_init(void)
 {
+	int ret;
+
 	driver.num_ioctls = nouveau_max_ioctl;
 
 	if (nouveau_modeset == -1) {
@@ -488,13 +543,21 @@ static int __init nouveau_init(void)
 		nouveau_register_dsm_handler();
 	}
 
-	return drm_init(&driver);
+	ret = pscnv_mm_cache_init();
+	if (ret)
+		return ret;
+
+	ret = drm_init(&driver);
+	if (ret)
+		pscnv_mm_cache_takedown();
+	return ret;
 }
 
 static void __exit nouveau_exit(void)
 {
 	drm_exit(&driver);
 	nouveau_unregister_dsm_handler();
+	pscnv_mm_cache_takedown();
 }
 
 module_init(nouveau_init);
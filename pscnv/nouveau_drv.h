@@ -34,7 +34,7 @@
 
 #define DRIVER_MAJOR		0
 #define DRIVER_MINOR		0
-#define DRIVER_PATCHLEVEL	16
+#define DRIVER_PATCHLEVEL	17
 
 #define DRM_FILE_PAGE_OFFSET (0x100000000ULL >> PAGE_SHIFT)
 
@@ -444,8 +444,30 @@ struct drm_nouveau_private {
 
 	uint64_t mmio_phys;
 
-	struct pscnv_mm *vram_mm;
-	struct mutex vram_mutex;
+	struct pscnv_vram_heap vram_heaps[PSCNV_VRAM_HEAPS_MAX];
+	int vram_nheaps;
+	/* serializes pscnv_vram_compact runs */
+	struct mutex vram_compact_mutex;
+	/* BOs moved by the last run asked for through debugfs */
+	int vram_compact_moved;
+	struct pscnv_bo_cache bo_cache;
+	/* movable VRAM BOs, least recently mapped first */
+	struct list_head vram_lru;
+	spinlock_t vram_lru_lock;
+	uint64_t vram_evictions;
+	uint64_t vram_evicted_bytes;
+	uint64_t vram_restores;
+	uint64_t vram_restored_bytes;
+	/* GEM BOs waiting for pscnv_mem_free_work */
+	struct list_head bo_free_list;
+	spinlock_t bo_free_lock;
+	struct work_struct bo_free_work;
+	/* open files, see pscnv_client.c */
+	struct list_head clients;
+	struct mutex clients_lock;
+	/* backs the unpopulated parts of lazy sysram BOs in GPU mappings */
+	struct page *dummy_page;
+	dma_addr_t dummy_dma;
 
 	/* for slow-path nv_wv32/nv_rv32 */
 
@@ -483,6 +505,7 @@ struct drm_nouveau_private {
 
 	struct {
 		struct dentry *channel_root;
+		struct dentry *vram_compact;
 	} debugfs;
 
 	struct nouveau_fbdev *nfbdev;
@@ -536,6 +559,15 @@ extern int nouveau_reg_debug;
 extern int pscnv_mm_debug;
 extern int pscnv_mem_debug;
 extern int pscnv_vm_debug;
+extern int pscnv_vram_compact_on_fail;
+extern int pscnv_vram_evict_on_fail;
+extern int pscnv_vram_heaps;
+extern int pscnv_vram_lp_buddy;
+extern int pscnv_bo_cache_size;
+extern int pscnv_sysram_fault_around;
+extern int pscnv_sysram_prefault;
+extern int pscnv_client_soft_limit;
+extern int pscnv_client_hard_limit;
 extern int pscnv_gem_debug;
 extern int pscnv_ramht_debug;
 extern char *nouveau_vbios;
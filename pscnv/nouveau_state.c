@@ -42,6 +42,7 @@
 #include "pscnv_chan.h"
 #include "pscnv_fifo.h"
 #include "pscnv_ioctl.h"
+#include "pscnv_client.h"
 
 static void nouveau_stub_takedown(struct drm_device *dev) {}
 static int nouveau_stub_init(struct drm_device *dev) { return 0; }
@@ -488,6 +489,7 @@ int nouveau_load(struct drm_device *dev, unsigned long flags)
 		return -ENOMEM;
 	dev->dev_private = dev_priv;
 	dev_priv->dev = dev;
+	pscnv_client_init(dev);
 
 	dev_priv->flags = flags/* & NOUVEAU_FLAGS*/;
 	dev_priv->init_state = NOUVEAU_CARD_INIT_DOWN;
@@ -43,8 +43,8 @@ int nv50_chan_new (struct pscnv_chan *ch) {
 		chan_pd = NV84_CHAN_PD;
 	for (i = 0; i < NV50_VM_PDE_COUNT; i++) {
 		if (nv50_vs(vs)->pt[i]) {
-			nv_wv32(ch->bo, chan_pd + i * 8 + 4, nv50_vs(vs)->pt[i]->start >> 32);
-			nv_wv32(ch->bo, chan_pd + i * 8, nv50_vs(vs)->pt[i]->start | 0x3);
+			nv_wv32(ch->bo, chan_pd + i * 8 + 4, nv50_vspace_pde(vs, i) >> 32);
+			nv_wv32(ch->bo, chan_pd + i * 8, nv50_vspace_pde(vs, i));
 		} else {
 			nv_wv32(ch->bo, chan_pd + i * 8, 0);
 		}
@@ -54,12 +54,10 @@ int nv50_chan_new (struct pscnv_chan *ch) {
 	ch->instpos = chan_pd + NV50_VM_PDE_COUNT * 8;
 
 	if (ch->cid >= 0) {
-		int i;
 		ch->ramht.bo = ch->bo;
 		ch->ramht.bits = 9;
 		ch->ramht.offset = nv50_chan_iobj_new(ch, 8 << ch->ramht.bits);
-		for (i = 0; i < (8 << ch->ramht.bits); i += 8)
-			nv_wv32(ch->ramht.bo, ch->ramht.offset + i + 4, 0);
+		pscnv_mem_fill(ch->ramht.bo, ch->ramht.offset, 8 << ch->ramht.bits, 0);
 
 		if (dev_priv->chipset == 0x50) {
 			ch->ramfc = 0;
@@ -48,6 +48,7 @@ void nv50_fifo_chan_kill(struct pscnv_chan *ch);
 
 int nv50_fifo_init(struct drm_device *dev) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	const uint64_t playlist_sizes[2] = { 0x1000, 0x1000 };
 	int i;
 	struct nv50_fifo_engine *res = kzalloc(sizeof *res, GFP_KERNEL);
 
@@ -62,14 +63,8 @@ int nv50_fifo_init(struct drm_device *dev) {
 	res->base.chan_init_ib = nv50_fifo_chan_init_ib;
 	spin_lock_init(&res->lock);
 
-	res->playlist[0] = pscnv_mem_alloc(dev, 0x1000, PSCNV_GEM_CONTIG, 0, 0x91a71157);
-	res->playlist[1] = pscnv_mem_alloc(dev, 0x1000, PSCNV_GEM_CONTIG, 0, 0x91a71157);
-	if (!res->playlist[0] || !res->playlist[1]) {
+	if (pscnv_mem_alloc_batch(dev, 2, playlist_sizes, PSCNV_GEM_CONTIG, 0, 0x91a71157, res->playlist)) {
 		NV_ERROR(dev, "PFIFO: Couldn't allocate playlists!\n");
-		if (res->playlist[0])
-			pscnv_mem_free(res->playlist[0]);
-		if (res->playlist[1])
-			pscnv_mem_free(res->playlist[1]);
 		kfree(res);
 		return -ENOMEM;
 	}
@@ -279,7 +279,6 @@ int nv50_graph_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 	struct nouveau_grctx ctx = {};
 	uint32_t hdr;
 	uint64_t limit;
-	int i;
 	struct nv50_graph_chan *grch = kzalloc(sizeof *grch, GFP_KERNEL);
 
 	if (!grch) {
@@ -297,8 +296,7 @@ int nv50_graph_chan_alloc(struct pscnv_engine *eng, struct pscnv_chan *ch) {
 		kfree(grch);
 		return -ENOMEM;
 	}
-	for (i = 0; i < graph->grctx_size; i += 4)
-		nv_wv32(grch->grctx, i, 0);
+	pscnv_mem_fill(grch->grctx, 0, graph->grctx_size, 0);
 	ctx.dev = dev;
 	ctx.mode = NOUVEAU_GRCTX_VALS;
 	ctx.data = grch->grctx;
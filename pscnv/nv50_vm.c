@@ -5,10 +5,11 @@
 #include "pscnv_vm.h"
 #include "nv50_chan.h"
 #include "pscnv_chan.h"
+#include <linux/vmalloc.h>
 
 int nv50_vm_map_kernel(struct pscnv_bo *bo);
 void nv50_vm_takedown(struct drm_device *dev);
-int nv50_vspace_do_unmap (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
+int nv50_vspace_clear_ptes (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
 
 int
 nv50_vm_flush(struct drm_device *dev, int unit) {
@@ -33,22 +34,33 @@ int nv50_vspace_tlb_flush (struct pscnv_vspace *vs) {
 	return 0;
 }
 
+/* Allocates an empty PT of small or large pages, and its shadow. */
 static int
-nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
-	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
-	struct list_head *pos;
-	int i;
-	uint32_t chan_pd;
-	nv50_vs(vs)->pt[pdenum] = pscnv_mem_alloc(vs->dev, NV50_VM_SPTE_COUNT * 8, PSCNV_GEM_CONTIG, 0, 0xa9e7ab1e);
-	if (!nv50_vs(vs)->pt[pdenum]) {
+nv50_vspace_alloc_pt (struct pscnv_vspace *vs, int lp, struct pscnv_bo **pt, uint32_t **shadow) {
+	uint32_t size = (lp ? NV50_VM_LPTE_COUNT : NV50_VM_SPTE_COUNT) * 8;
+	*shadow = vmalloc(size);
+	if (!*shadow)
+		return -ENOMEM;
+	memset(*shadow, 0, size);
+	*pt = pscnv_mem_alloc(vs->dev, size, PSCNV_GEM_CONTIG, 0, 0xa9e7ab1e);
+	if (!*pt) {
+		vfree(*shadow);
 		return -ENOMEM;
 	}
+	vs->pgt_bytes += (*pt)->size;
 
 	if (vs->vid != -1)
-		nv50_vm_map_kernel(nv50_vs(vs)->pt[pdenum]);
+		nv50_vm_map_kernel(*pt);
 
-	for (i = 0; i < NV50_VM_SPTE_COUNT; i++)
-		nv_wv32(nv50_vs(vs)->pt[pdenum], i * 8, 0);
+	pscnv_mem_fill(*pt, 0, size, 0);
+	return 0;
+}
+
+static void
+nv50_vspace_write_pde (struct pscnv_vspace *vs, uint32_t pdenum) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct list_head *pos;
+	uint32_t chan_pd;
 
 	if (dev_priv->chipset == 0x50)
 		chan_pd = NV50_CHAN_PD;
@@ -57,109 +69,317 @@ nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
 
 	list_for_each(pos, &nv50_vs(vs)->chan_list) {
 		struct pscnv_chan *ch = list_entry(pos, struct pscnv_chan, vspace_list);
-		uint64_t pde = nv50_vs(vs)->pt[pdenum]->start | 3;
+		uint64_t pde = nv50_vspace_pde(vs, pdenum);
 		nv_wv32(ch->bo, chan_pd + pdenum * 8 + 4, pde >> 32);
 		nv_wv32(ch->bo, chan_pd + pdenum * 8, pde);
 	}
+}
+
+static int
+nv50_vspace_fill_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum, int lp) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	struct pscnv_bo *pt;
+	uint32_t *shadow;
+	int ret;
+	if ((ret = nv50_vspace_alloc_pt(vs, lp, &pt, &shadow)))
+		return ret;
+	nvs->shadow[pdenum] = shadow;
+	nvs->lp[pdenum] = lp;
+	nvs->pt[pdenum] = pt;
+	nv50_vspace_write_pde(vs, pdenum);
+	return 0;
+}
+
+/* Replaces the large page PT of a PDE with a small page one, so that
+ * small pages can be mapped next to the large ones already there. Each
+ * large PTE becomes 16 small ones, with the contig level raised to
+ * match. The new PT is complete before the PDE is switched over. */
+static int
+nv50_vspace_demote_pd_slot (struct pscnv_vspace *vs, uint32_t pdenum) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	struct pscnv_bo *lpt = nvs->pt[pdenum], *pt;
+	uint32_t *lshadow = nvs->shadow[pdenum], *shadow;
+	unsigned long flags;
+	uint32_t i, k;
+	int ret;
+	if ((ret = nv50_vspace_alloc_pt(vs, 0, &pt, &shadow)))
+		return ret;
+	for (i = 0; i < NV50_VM_LPTE_COUNT; i++) {
+		uint64_t pte = (uint64_t)lshadow[i * 2 + 1] << 32 | lshadow[i * 2];
+		int lev = pte >> 7 & 7, slev = min(lev + 4, 7);
+		uint64_t addr;
+		if (!(pte & 1))
+			continue;
+		/* all PTEs of a contig block hold its start address */
+		addr = (pte & NV50_VM_PTE_ADDR_MASK) + ((uint64_t)(i & ((1 << lev) - 1)) << 16);
+		pte &= ~(NV50_VM_PTE_ADDR_MASK | 7 << 7);
+		for (k = 0; k < 16; k++) {
+			uint64_t spte = pte | ((addr + k * 0x1000) & ~((0x1000ULL << slev) - 1)) | slev << 7;
+			shadow[(i * 16 + k) * 2 + 1] = spte >> 32;
+			shadow[(i * 16 + k) * 2] = spte;
+		}
+	}
+	pscnv_mem_write(pt, 0, shadow, NV50_VM_SPTE_COUNT * 8);
+	/* the trap handler reads the shadows under ch_lock */
+	spin_lock_irqsave(&dev_priv->chan->ch_lock, flags);
+	nvs->shadow[pdenum] = shadow;
+	nvs->lp[pdenum] = 0;
+	nvs->pt[pdenum] = pt;
+	spin_unlock_irqrestore(&dev_priv->chan->ch_lock, flags);
+	dev_priv->vm->bar_flush(vs->dev);
+	nv50_vspace_write_pde(vs, pdenum);
+	dev_priv->vm->bar_flush(vs->dev);
+	nv50_vspace_tlb_flush(vs);
+	vs->pgt_bytes -= lpt->size;
+	pscnv_mem_free(lpt);
+	vfree(lshadow);
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "VM: vspace %d: PDE %x demoted to small pages\n", vs->vid, pdenum);
 	return 0;
 }
 
 int
-nv50_vspace_place_map (struct pscnv_vspace *vs, struct pscnv_bo *bo,
+nv50_vspace_place_map (struct pscnv_vspace *vs, struct pscnv_mm *mm, struct pscnv_bo *bo,
+		uint64_t bo_offset, uint64_t length,
 		uint64_t start, uint64_t end, int back,
 		struct pscnv_mm_node **res) {
-	return pscnv_mm_alloc(vs->mm, bo->size, back?PSCNV_MM_FROMBACK:0, start, end, res);
+	int flags = 0;
+	/* the BAR vspace sticks to small pages */
+	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE && vs->vid != -1)
+		flags = PSCNV_MM_LP;
+	if (back)
+		flags |= PSCNV_MM_FROMBACK;
+	return pscnv_mm_alloc(mm, length, flags, start, end, res);
 }
 
+/* Copies the PTEs edited since the last call from the shadows to the
+ * PTs, one memcpy_toio per PT touched. Must come before the BAR and
+ * TLB flushes that make the edits visible. */
+static void
+nv50_vspace_upload (struct pscnv_vspace *vs) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	uint32_t pgnum = nvs->dirty_start;
+	while (pgnum < nvs->dirty_end) {
+		uint32_t pdenum = pgnum / NV50_VM_SPTE_COUNT;
+		uint32_t ptenum = pgnum % NV50_VM_SPTE_COUNT;
+		uint32_t num = min_t(uint32_t, nvs->dirty_end - pgnum, NV50_VM_SPTE_COUNT - ptenum);
+		if (nvs->pt[pdenum] && nvs->lp[pdenum]) {
+			uint32_t lo = ptenum >> 4, hi = (ptenum + num + 15) >> 4;
+			pscnv_mem_write(nvs->pt[pdenum], lo * 8, &nvs->shadow[pdenum][lo * 2], (hi - lo) * 8);
+		} else if (nvs->pt[pdenum]) {
+			pscnv_mem_write(nvs->pt[pdenum], ptenum * 8, &nvs->shadow[pdenum][ptenum * 2], num * 8);
+		}
+		pgnum += num;
+	}
+	nvs->dirty_start = nvs->dirty_end = 0;
+}
+
+/* Marks PTEs for the next upload. The dirty range is kept contiguous:
+ * an edit away from it pushes the range first, so that the PTEs in
+ * between don't get copied for nothing. */
+static void
+nv50_vspace_dirty (struct pscnv_vspace *vs, uint32_t pgnum, uint32_t num) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
+	if (nvs->dirty_start < nvs->dirty_end &&
+			(pgnum > nvs->dirty_end || pgnum + num < nvs->dirty_start))
+		nv50_vspace_upload(vs);
+	if (nvs->dirty_start >= nvs->dirty_end) {
+		nvs->dirty_start = pgnum;
+		nvs->dirty_end = pgnum + num;
+		return;
+	}
+	if (pgnum < nvs->dirty_start)
+		nvs->dirty_start = pgnum;
+	if (pgnum + num > nvs->dirty_end)
+		nvs->dirty_end = pgnum + num;
+}
+
+/* Maps a physically contiguous range. With lp, offset, pte and size
+ * have to be 64 KiB aligned, and the range goes to large page PTs where
+ * the PDE has none yet. PDEs that already have small pages keep them:
+ * the contig bits then give much the same TLB reach. */
 static int nv50_vspace_map_contig_range (struct pscnv_vspace *vs, uint64_t offset, uint64_t pte, uint64_t size, int lp) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
 	int ret;
-	/* XXX: add LP support */
-	BUG_ON(lp);
 	while (size) {
-		uint32_t pgnum = offset / 0x1000;
-		uint32_t pdenum = pgnum / NV50_VM_SPTE_COUNT;
-		uint32_t ptenum = pgnum % NV50_VM_SPTE_COUNT;
-		int lev = 0;
+		uint32_t pdenum = offset / NV50_VM_BLOCK_SIZE;
+		uint32_t ptenum;
+		int lev = 0, psh;
 		int i;
-		while (lev < 7 && size >= (0x1000 << (lev + 1)) && !(offset & (1 << (lev + 12))))
-			lev++;
-		if (!nv50_vs(vs)->pt[pdenum])
-			if ((ret = nv50_vspace_fill_pd_slot (vs, pdenum)))
+		if (!nvs->pt[pdenum]) {
+			if ((ret = nv50_vspace_fill_pd_slot (vs, pdenum, lp)))
+				return ret;
+		} else if (nvs->lp[pdenum] && !lp) {
+			if ((ret = nv50_vspace_demote_pd_slot (vs, pdenum)))
 				return ret;
+		}
+		psh = nvs->lp[pdenum] ? 16 : 12;
+		ptenum = (offset % NV50_VM_BLOCK_SIZE) >> psh;
+		while (lev < 7 && size >= (1ULL << (psh + lev + 1)) && !((offset | pte) & (1ULL << (psh + lev))))
+			lev++;
+		nv50_vspace_dirty(vs, offset >> 12, 1 << (psh - 12 + lev));
 		for (i = 0; i < (1 << lev); i++) {
-			nv_wv32(nv50_vs(vs)->pt[pdenum], (ptenum + i) * 8 + 4, pte >> 32);
-			nv_wv32(nv50_vs(vs)->pt[pdenum], (ptenum + i) * 8, pte | lev << 7);
+			nvs->shadow[pdenum][(ptenum + i) * 2 + 1] = pte >> 32;
+			nvs->shadow[pdenum][(ptenum + i) * 2] = pte | lev << 7;
 			if (pscnv_vm_debug >= 3)
-				NV_INFO(vs->dev, "VM: [%08x][%08x] = %016llx\n", pdenum, ptenum + i, pte | lev << 7);
+				NV_INFO(vs->dev, "VM: [%08x][%08x]%s = %016llx\n", pdenum, ptenum + i, psh == 16 ? "L" : "", pte | lev << 7);
 		}
-		size -= (0x1000 << lev);
-		offset += (0x1000 << lev);
-		pte += (0x1000 << lev);
+		size -= (1ULL << (psh + lev));
+		offset += (1ULL << (psh + lev));
+		pte += (1ULL << (psh + lev));
 	}
 	return 0;
 }
 
+/* Writes the PTEs of one sysram chunk of a BO, as far as it is inside
+ * the bo_offset..bo_offset+length slice mapped at offset: a contiguous
+ * range per DMA segment, so that the contig bits get used wherever
+ * they can, or the dummy page if it isn't populated yet. The dummy page
+ * is shared by every client, so it is always mapped read-only. Called
+ * with the BO's sysram_lock held. */
+static int
+nv50_vspace_map_chunk (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset,
+		uint64_t bo_offset, uint64_t length, int chunk) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct sg_table *sgt = &bo->chunks[chunk];
+	struct scatterlist *sg;
+	uint64_t roff = (uint64_t)chunk << PSCNV_SYSRAM_CHUNK_SHIFT;
+	uint64_t end = min_t(uint64_t, bo_offset + length, roff + PSCNV_SYSRAM_CHUNK_SIZE);
+	uint64_t fl = 1, s, e;
+	int ret, i;
+	if (pscnv_bo_memtype(bo) == PSCNV_GEM_SYSRAM_SNOOP)
+		fl |= 0x20;
+	else
+		fl |= 0x30;
+	if (bo->flags & PSCNV_GEM_READONLY)
+		fl |= 8; /* read-only */
+	if (!sgt->sgl) {
+		for (roff = max_t(uint64_t, roff, bo_offset); roff < end; roff += PAGE_SIZE)
+			if ((ret = nv50_vspace_map_contig_range(vs, offset + roff - bo_offset, dev_priv->dummy_dma | fl | 8, PAGE_SIZE, 0)))
+				return ret;
+		return 0;
+	}
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		s = max_t(uint64_t, roff, bo_offset);
+		e = min_t(uint64_t, roff + sg_dma_len(sg), end);
+		if (s < e && (ret = nv50_vspace_map_contig_range(vs, offset + s - bo_offset,
+						(sg_dma_address(sg) + s - roff) | fl, e - s, 0)))
+			return ret;
+		roff += sg_dma_len(sg);
+	}
+	return 0;
+}
+
+static int
+nv50_vspace_remap_chunk (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset,
+		uint64_t bo_offset, uint64_t length, int chunk) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	int ret;
+	mutex_lock(&bo->sysram_lock);
+	ret = nv50_vspace_map_chunk(vs, bo, offset, bo_offset, length, chunk);
+	mutex_unlock(&bo->sysram_lock);
+	nv50_vspace_upload(vs);
+	dev_priv->vm->bar_flush(vs->dev);
+	if (vs->vid == -1)
+		nv50_vm_flush(vs->dev, 6);
+	else
+		nv50_vspace_tlb_flush(vs);
+	return ret;
+}
+
 int
-nv50_vspace_do_map (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset) {
+nv50_vspace_map_ptes (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset,
+		uint64_t bo_offset, uint64_t length) {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	struct pscnv_mm_node *n;
-	int ret, i;
-	uint64_t roff = 0;
-	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
+	int ret = 0, i;
+	uint64_t roff = 0, s, e;
+	switch (pscnv_bo_memtype(bo)) {
 		case PSCNV_GEM_VRAM_SMALL:
 		case PSCNV_GEM_VRAM_LARGE:
-			for (n = bo->mmnode; n; n = n->next) {
-				/* XXX: add LP support */
-				uint64_t pte = n->start;
+			for (n = bo->mmnode; n && roff < bo_offset + length; roff += n->size, n = n->next) {
+				uint64_t pte;
+				int lp;
+				/* the part of the node inside the slice */
+				s = max_t(uint64_t, roff, bo_offset);
+				e = min_t(uint64_t, roff + n->size, bo_offset + length);
+				if (s >= e)
+					continue;
+				pte = n->start + s - roff;
+				/* large pages wherever the node allows, see place_map */
+				lp = (bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE && vs->vid != -1 &&
+					!((offset + s - bo_offset) & 0xffff) && !(pte & 0xffff) && !((e - s) & 0xffff);
 				if (dev_priv->chipset == 0xaa || dev_priv->chipset == 0xac || dev_priv->chipset == 0xaf) {
 					pte += dev_priv->vram_sys_base;
 					pte |= 0x30;
 				}
 				pte |= (uint64_t)bo->tile_flags << 40;
 				pte |= 1; /* present */
-				if ((ret = nv50_vspace_map_contig_range(vs, offset + roff, pte, n->size, 0))) {
-					nv50_vspace_do_unmap (vs, offset, bo->size);
+				if ((ret = nv50_vspace_map_contig_range(vs, offset + s - bo_offset, pte, e - s, lp))) {
+					nv50_vspace_clear_ptes (vs, offset, length);
 					return ret;
 				}
-				roff += n->size;
 			}
 			break;
 		case PSCNV_GEM_SYSRAM_SNOOP:
 		case PSCNV_GEM_SYSRAM_NOSNOOP:
-			for (i = 0; i < (bo->size >> PAGE_SHIFT); i++) {
-				uint64_t pte = bo->dmapages[i];
-				pte |= 1;
-				if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_SYSRAM_SNOOP)
-					pte |= 0x20;
-				else
-					pte |= 0x30;
-				if ((ret = nv50_vspace_map_contig_range(vs, offset + roff, pte, PAGE_SIZE, 0))) {
-					nv50_vspace_do_unmap (vs, offset, bo->size);
-					return ret;
-				}
-				roff += PAGE_SIZE;
+			mutex_lock(&bo->sysram_lock);
+			for (i = bo_offset >> PSCNV_SYSRAM_CHUNK_SHIFT; (uint64_t)i << PSCNV_SYSRAM_CHUNK_SHIFT < bo_offset + length; i++)
+				if ((ret = nv50_vspace_map_chunk(vs, bo, offset, bo_offset, length, i)))
+					break;
+			mutex_unlock(&bo->sysram_lock);
+			if (ret) {
+				nv50_vspace_clear_ptes (vs, offset, length);
+				return ret;
 			}
 			break;
 		default:
 			return -ENOSYS;
 	}
-	dev_priv->vm->bar_flush(vs->dev);
 	return 0;
 }
 
 int
-nv50_vspace_do_unmap (struct pscnv_vspace *vs, uint64_t offset, uint64_t length) {
-	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+nv50_vspace_clear_ptes (struct pscnv_vspace *vs, uint64_t offset, uint64_t length) {
+	struct nv50_vspace *nvs = nv50_vs(vs);
 	while (length) {
-		uint32_t pgnum = offset / 0x1000;
-		uint32_t pdenum = pgnum / NV50_VM_SPTE_COUNT;
-		uint32_t ptenum = pgnum % NV50_VM_SPTE_COUNT;
-		if (nv50_vs(vs)->pt[pdenum]) {
-			nv_wv32(nv50_vs(vs)->pt[pdenum], ptenum * 8, 0);
+		uint32_t pdenum = offset / NV50_VM_BLOCK_SIZE;
+		uint64_t step = 0x1000;
+		if (nvs->pt[pdenum] && nvs->lp[pdenum]) {
+			step = 0x10000 - (offset & 0xffff);
+			nvs->shadow[pdenum][(offset % NV50_VM_BLOCK_SIZE) >> 16 << 1] = 0;
+		} else if (nvs->pt[pdenum]) {
+			nvs->shadow[pdenum][(offset % NV50_VM_BLOCK_SIZE) >> 12 << 1] = 0;
+		} else {
+			/* no PT, nothing to clear up to the next PDE */
+			step = NV50_VM_BLOCK_SIZE - (offset % NV50_VM_BLOCK_SIZE);
 		}
-		offset += 0x1000;
-		length -= 0x1000;
+		step = min_t(uint64_t, step, length);
+		if (nvs->pt[pdenum])
+			nv50_vspace_dirty(vs, offset >> 12, step >> 12);
+		offset += step;
+		length -= step;
 	}
+	return 0;
+}
+
+/* Points a range at the dummy page, in small pages. It is shared by
+ * every vspace, so read-only. */
+static int
+nv50_vspace_dummy_ptes (struct pscnv_vspace *vs, uint64_t offset, uint64_t length) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	int ret;
+	for (; length; offset += PAGE_SIZE, length -= PAGE_SIZE)
+		if ((ret = nv50_vspace_map_contig_range(vs, offset, dev_priv->dummy_dma | 0x29, PAGE_SIZE, 0)))
+			return ret;
+	return 0;
+}
+
+int
+nv50_vspace_flush (struct pscnv_vspace *vs) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	nv50_vspace_upload(vs);
 	dev_priv->vm->bar_flush(vs->dev);
 	if (vs->vid == -1) {
 		return nv50_vm_flush(vs->dev, 6);
@@ -169,6 +389,28 @@ nv50_vspace_do_unmap (struct pscnv_vspace *vs, uint64_t offset, uint64_t length)
 	return 0;
 }
 
+int
+nv50_vspace_do_map (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset,
+		uint64_t bo_offset, uint64_t length) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	int ret = nv50_vspace_map_ptes(vs, bo, offset, bo_offset, length);
+	if (ret) {
+		/* PTEs written before the failure got cleared again */
+		nv50_vspace_flush(vs);
+		return ret;
+	}
+	/* new PTEs only: nothing stale in the TLBs */
+	nv50_vspace_upload(vs);
+	dev_priv->vm->bar_flush(vs->dev);
+	return 0;
+}
+
+int
+nv50_vspace_do_unmap (struct pscnv_vspace *vs, uint64_t offset, uint64_t length) {
+	nv50_vspace_clear_ptes(vs, offset, length);
+	return nv50_vspace_flush(vs);
+}
+
 int nv50_vspace_new(struct pscnv_vspace *vs) {
 	int ret;
 
@@ -193,6 +435,7 @@ void nv50_vspace_free(struct pscnv_vspace *vs) {
 	for (i = 0; i < NV50_VM_PDE_COUNT; i++) {
 		if (nv50_vs(vs)->pt[i]) {
 			pscnv_mem_free(nv50_vs(vs)->pt[i]);
+			vfree(nv50_vs(vs)->shadow[i]);
 		}
 	}
 	kfree(vs->engdata);
@@ -245,6 +488,11 @@ nv50_vm_init(struct drm_device *dev) {
 	vme->base.place_map = nv50_vspace_place_map;
 	vme->base.do_map = nv50_vspace_do_map;
 	vme->base.do_unmap = nv50_vspace_do_unmap;
+	vme->base.map_ptes = nv50_vspace_map_ptes;
+	vme->base.clear_ptes = nv50_vspace_clear_ptes;
+	vme->base.flush = nv50_vspace_flush;
+	vme->base.dummy_ptes = nv50_vspace_dummy_ptes;
+	vme->base.remap_chunk = nv50_vspace_remap_chunk;
 	vme->base.map_user = nv50_vm_map_user;
 	vme->base.map_kernel = nv50_vm_map_kernel;
 	if (dev_priv->chipset == 0x50)
@@ -478,6 +726,41 @@ static struct pscnv_enumval *pscnv_enum_find (struct pscnv_enumval *list, int va
 		return 0;
 }
 
+/* Describes what the faulting address hit in the channel's vspace. This
+ * runs from the interrupt handler, so it uses the lockless lookup and
+ * only reports the mapping's range, its BO may be gone already, and the
+ * PTE as last written to the shadow. */
+static void nv50_vm_trap_mapping(struct drm_device *dev, int cid, uint64_t addr, char *buf, int len) {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chan *ch;
+	struct pscnv_mm_node node;
+	unsigned long flags;
+	uint32_t pdenum = addr / NV50_VM_BLOCK_SIZE % NV50_VM_PDE_COUNT;
+	uint32_t *shadow;
+	uint64_t pte = 0;
+	int ret = -ENOENT;
+	spin_lock_irqsave(&dev_priv->chan->ch_lock, flags);
+	ch = (cid < 0 ? dev_priv->chan->fake_chans[-cid] : dev_priv->chan->chans[cid]);
+	/* the channel holds a reference to its vspace */
+	if (ch && ch->vspace) {
+		ret = pscnv_mm_lookup(ch->vspace->mm, addr, &node);
+		shadow = ch->vspace->engdata ? nv50_vs(ch->vspace)->shadow[pdenum] : 0;
+		if (shadow) {
+			int i = (addr % NV50_VM_BLOCK_SIZE) >> (nv50_vs(ch->vspace)->lp[pdenum] ? 16 : 12);
+			pte = (uint64_t)shadow[i * 2 + 1] << 32 | shadow[i * 2];
+		}
+	}
+	spin_unlock_irqrestore(&dev_priv->chan->ch_lock, flags);
+	if (ret == -EBUSY)
+		snprintf(buf, len, "vspace busy, pte %llx", pte);
+	else if (ret || node.type == PSCNV_MM_TYPE_FREE || node.cached)
+		snprintf(buf, len, "unmapped, pte %llx", pte);
+	else if (!node.tag)
+		snprintf(buf, len, "reservation %llx-%llx, pte %llx", node.start, node.start + node.size, pte);
+	else
+		snprintf(buf, len, "mapping %llx-%llx, pte %llx", node.start, node.start + node.size, pte);
+}
+
 void nv50_vm_trap(struct drm_device *dev) {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	uint32_t trap[6];
@@ -488,6 +771,8 @@ void nv50_vm_trap(struct drm_device *dev) {
 	char unit1[50];
 	char unit2[50];
 	char unit3[50];
+	char mapping[80];
+	uint64_t addr;
 	struct pscnv_enumval *ev;
 	int chan;
 	if (idx & 0x80000000) {
@@ -527,10 +812,12 @@ void nv50_vm_trap(struct drm_device *dev) {
 			snprintf(unit3, sizeof(unit3), "0x%x", s3);
 		chan = pscnv_chan_handle_lookup(dev, trap[2] << 16 | trap[1]);
 		if (chan != 128) {
-			NV_INFO(dev, "VM: Trapped %s at %02x%04x%04x ch %d on %s/%s/%s, reason %s\n",
+			addr = (uint64_t)(trap[5]&0xff) << 32 | (trap[4]&0xffff) << 16 | (trap[3]&0xffff);
+			nv50_vm_trap_mapping(dev, chan, addr, mapping, sizeof(mapping));
+			NV_INFO(dev, "VM: Trapped %s at %02x%04x%04x ch %d on %s/%s/%s, reason %s, %s\n",
 				(trap[5]&0x100?"read":"write"),
 				trap[5]&0xff, trap[4]&0xffff,
-				trap[3]&0xffff, chan, unit1, unit2, unit3, reason);
+				trap[3]&0xffff, chan, unit1, unit2, unit3, reason, mapping);
 		} else {
 			NV_INFO(dev, "VM: Trapped %s at %02x%04x%04x UNKNOWN ch %08x on %s/%s/%s, reason %s\n",
 				(trap[5]&0x100?"read":"write"),
@@ -9,6 +9,10 @@
 #define NV50_VM_PDE_COUNT	0x800
 #define NV50_VM_SPTE_COUNT	0x20000
 #define NV50_VM_LPTE_COUNT	0x2000
+/* virtual range of one PDE */
+#define NV50_VM_BLOCK_SIZE	0x20000000
+/* address bits of a PTE, the rest being flags and the contig level */
+#define NV50_VM_PTE_ADDR_MASK	0xfffffff000ULL
 
 #define nv50_vm(x) container_of(x, struct nv50_vm_engine, base)
 #define nv50_vs(x) ((struct nv50_vspace *)(x)->engdata)
@@ -23,8 +27,23 @@ struct nv50_vspace {
 	struct list_head chan_list;
 	int engref[PSCNV_ENGINES_NUM];
 	struct pscnv_bo *pt[NV50_VM_PDE_COUNT];
+	/* set for PTs of 64 KiB pages. A PDE covers one page size only:
+	 * small pages mapped in a large page PT demote it, see
+	 * nv50_vspace_demote_pd_slot. */
+	uint8_t lp[NV50_VM_PDE_COUNT];
+	/* host copies of the PTs, as pairs of 32-bit words. PTE edits go
+	 * here and reach VRAM in bulk, see nv50_vspace_upload. */
+	uint32_t *shadow[NV50_VM_PDE_COUNT];
+	/* page numbers of the PTEs edited since the last upload */
+	uint32_t dirty_start;
+	uint32_t dirty_end;
 };
 
+static inline uint64_t
+nv50_vspace_pde(struct pscnv_vspace *vs, int pdenum) {
+	return nv50_vs(vs)->pt[pdenum]->start | (nv50_vs(vs)->lp[pdenum] ? 1 : 3);
+}
+
 int nv50_vm_flush (struct drm_device *dev, int unit);
 void nv50_vm_trap(struct drm_device *dev);
 
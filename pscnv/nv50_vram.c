@@ -30,6 +30,7 @@
 #include "pscnv_mem.h"
 
 int nv50_vram_alloc(struct pscnv_bo *bo);
+int nv50_vram_alloc_batch(struct pscnv_bo **bos, int num);
 
 int
 nv50_vram_init(struct drm_device *dev)
@@ -48,7 +49,9 @@ nv50_vram_init(struct drm_device *dev)
 	}
 
 	dev_priv->vram->alloc = nv50_vram_alloc;
+	dev_priv->vram->alloc_batch = nv50_vram_alloc_batch;
 	dev_priv->vram->free = pscnv_vram_free;
+	dev_priv->vram->free_batch = pscnv_vram_free_batch;
 	dev_priv->vram->takedown = pscnv_vram_takedown;
 
 	if (dev_priv->chipset == 0xaa || dev_priv->chipset == 0xac || dev_priv->chipset == 0xaf) {
@@ -56,6 +59,7 @@ nv50_vram_init(struct drm_device *dev)
 		dev_priv->vram_sys_base = (uint64_t)nv_rd32(dev, 0x100e10) << 12;
 		dev_priv->vram_size = (rc & 0xfffff000) | ((uint64_t)rc & 0xff) << 32;
 		rblock_size = 0x1000;
+		parts = 1;
 
 		NV_INFO(dev, "VRAM: IGP stolen area at %llx size 0x%llx",
 				dev_priv->vram_sys_base, dev_priv->vram_size);
@@ -102,7 +106,7 @@ nv50_vram_init(struct drm_device *dev)
 				dev_priv->vram_size, rblock_size);
 	}
 
-	ret = pscnv_mm_init(dev, 0x40000, dev_priv->vram_size - 0x20000, 0x1000, 0x10000, rblock_size, &dev_priv->vram_mm);
+	ret = pscnv_vram_heaps_init(dev, 0x40000, dev_priv->vram_size - 0x20000, 0x1000, 0x10000, rblock_size, parts);
 	if (ret) {
 		kfree(dev_priv->vram);
 		return ret;
@@ -114,10 +118,14 @@ nv50_vram_init(struct drm_device *dev)
 int
 nv50_vram_alloc(struct pscnv_bo *bo)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int flags, ret;
-	switch (bo->tile_flags) {
+	return nv50_vram_alloc_batch(&bo, 1);
+}
+
+int
+nv50_vram_alloc_batch(struct pscnv_bo **bos, int num)
+{
+	int flags, i;
+	switch (bos[0]->tile_flags) {
 		case 0:
 		case 0x10:
 		case 0x11:
@@ -190,20 +198,14 @@ nv50_vram_alloc(struct pscnv_bo *bo)
 		default:
 			return -EINVAL;
 	}
-	bo->size = roundup(bo->size, 0x1000);
-	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE) {
+	if ((bos[0]->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE)
 		flags |= PSCNV_MM_LP;
-		bo->size = roundup(bo->size, 0x10000);
-	}
-	if (!(bo->flags & PSCNV_GEM_CONTIG))
+	if (!(bos[0]->flags & PSCNV_GEM_CONTIG))
 		flags |= PSCNV_MM_FRAGOK;
-	mutex_lock(&dev_priv->vram_mutex);
-	ret = pscnv_mm_alloc(dev_priv->vram_mm, bo->size, flags, 0, dev_priv->vram_size, &bo->mmnode);
-	if (!ret) {
-		if (bo->flags & PSCNV_GEM_CONTIG)
-			bo->start = bo->mmnode->start;
-		bo->mmnode->tag = bo;
+	for (i = 0; i < num; i++) {
+		bos[i]->size = roundup(bos[i]->size, 0x1000);
+		if (flags & PSCNV_MM_LP)
+			bos[i]->size = roundup(bos[i]->size, 0x10000);
 	}
-	mutex_unlock(&dev_priv->vram_mutex);
-	return ret;
+	return pscnv_vram_alloc_nodes(bos, num, flags);
 }
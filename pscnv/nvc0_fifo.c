@@ -50,6 +50,7 @@ void nvc0_fifo_chan_kill(struct pscnv_chan *ch);
 int nvc0_fifo_init(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	const uint64_t playlist_sizes[2] = { 0x1000, 0x1000 };
 	struct nvc0_fifo_engine *res = kzalloc(sizeof *res, GFP_KERNEL);
 
 	if (!res) {
@@ -71,14 +72,8 @@ int nvc0_fifo_init(struct drm_device *dev)
 		return -ENOMEM;
 	}
 
-	res->playlist[0] = pscnv_mem_alloc(dev, 0x1000, PSCNV_GEM_CONTIG, 0, 0x91a71157);
-	res->playlist[1] = pscnv_mem_alloc(dev, 0x1000, PSCNV_GEM_CONTIG, 0, 0x91a71157);
-	if (!res->playlist[0] || !res->playlist[1]) {
+	if (pscnv_mem_alloc_batch(dev, 2, playlist_sizes, PSCNV_GEM_CONTIG, 0, 0x91a71157, res->playlist)) {
 		NV_ERROR(dev, "PFIFO: Couldn't allocate playlists!\n");
-		if (res->playlist[0])
-			pscnv_mem_free(res->playlist[0]);
-		if (res->playlist[1])
-			pscnv_mem_free(res->playlist[1]);
 		pscnv_mem_free(res->ctrl_bo);
 		kfree(res);
 		return -ENOMEM;
@@ -225,8 +220,7 @@ int nvc0_fifo_chan_init_ib (struct pscnv_chan *ch, uint32_t pb_handle, uint32_t
 	nvchan_wr32(ch, 0x88, 0);
 	nvchan_wr32(ch, 0x8c, 0);
 
-	for (i = 0; i < 0x100; i += 4)
-		nv_wv32(ch->bo, i, 0);
+	pscnv_mem_fill(ch->bo, 0, 0x100, 0);
 
 	dev_priv->vm->bar_flush(dev);
 
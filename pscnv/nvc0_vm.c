@@ -31,6 +31,7 @@
 #include "pscnv_chan.h"
 #include "nvc0_vm.h"
 #include <linux/list.h>
+#include <linux/vmalloc.h>
 
 #define PSCNV_GEM_NOUSER 0x10 /* XXX */
 
@@ -65,30 +66,45 @@ nvc0_vspace_fill_pde(struct pscnv_vspace *vs, struct nvc0_pgt *pgt)
 {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	const uint32_t size = NVC0_VM_SPTE_COUNT << (3 - pgt->limit);
-	int i;
 	uint32_t pde[2];
 
-	pgt->bo[1] = pscnv_mem_alloc(vs->dev, size, PSCNV_GEM_CONTIG, 0, 0x59);
-	if (!pgt->bo[1])
+	pgt->shadow[1] = vmalloc(size);
+	if (!pgt->shadow[1])
 		return -ENOMEM;
+	memset(pgt->shadow[1], 0, size);
+	if (vs->vid != -3) {
+		/* both page tables in one go */
+		const uint64_t sizes[2] = { size, NVC0_VM_LPTE_COUNT * 8 };
+		struct pscnv_bo *bos[2];
+		pgt->shadow[0] = kzalloc(NVC0_VM_LPTE_COUNT * 8, GFP_KERNEL);
+		if (!pgt->shadow[0] || pscnv_mem_alloc_batch(vs->dev, 2, sizes, PSCNV_GEM_CONTIG, 0, 0x59, bos)) {
+			kfree(pgt->shadow[0]);
+			vfree(pgt->shadow[1]);
+			return -ENOMEM;
+		}
+		pgt->bo[1] = bos[0];
+		pgt->bo[0] = bos[1];
+		pgt->bo[0]->cookie = 0x79;
+		vs->pgt_bytes += pgt->bo[0]->size;
+	} else {
+		pgt->bo[1] = pscnv_mem_alloc(vs->dev, size, PSCNV_GEM_CONTIG, 0, 0x59);
+		if (!pgt->bo[1]) {
+			vfree(pgt->shadow[1]);
+			return -ENOMEM;
+		}
+	}
+	vs->pgt_bytes += pgt->bo[1]->size;
 
-	for (i = 0; i < size; i += 4)
-		nv_wv32(pgt->bo[1], i, 0);
+	pscnv_mem_fill(pgt->bo[1], 0, size, 0);
 
 	pde[0] = pgt->limit << 2;
 	pde[1] = (pgt->bo[1]->start >> 8) | 1;
 
 	if (vs->vid != -3) {
-		pgt->bo[0] = pscnv_mem_alloc(vs->dev, NVC0_VM_LPTE_COUNT * 8,
-					      PSCNV_GEM_CONTIG, 0, 0x79);
-		if (!pgt->bo[0])
-			return -ENOMEM;
-
 		nvc0_vm_map_kernel(pgt->bo[0]);
 		nvc0_vm_map_kernel(pgt->bo[1]);
 
-		for (i = 0; i < NVC0_VM_LPTE_COUNT * 8; i += 4)
-			nv_wv32(pgt->bo[0], i, 0);
+		pscnv_mem_fill(pgt->bo[0], 0, NVC0_VM_LPTE_COUNT * 8, 0);
 
 		pde[0] |= (pgt->bo[0]->start >> 8) | 1;
 	}
@@ -120,6 +136,7 @@ nvc0_vspace_pgt(struct pscnv_vspace *vs, unsigned int pde)
 		return NULL;
 	pt->pde = pde;
 	pt->limit = 0;
+	INIT_LIST_HEAD(&pt->dirty);
 
 	if (nvc0_vspace_fill_pde(vs, pt)) {
 		kfree(pt);
@@ -133,10 +150,16 @@ nvc0_vspace_pgt(struct pscnv_vspace *vs, unsigned int pde)
 void
 nvc0_pgt_del(struct pscnv_vspace *vs, struct nvc0_pgt *pgt)
 {
+	vs->pgt_bytes -= pgt->bo[1]->size;
 	pscnv_vram_free(pgt->bo[1]);
-	if (pgt->bo[0])
+	if (pgt->bo[0]) {
+		vs->pgt_bytes -= pgt->bo[0]->size;
 		pscnv_vram_free(pgt->bo[0]);
+	}
 	list_del(&pgt->head);
+	list_del(&pgt->dirty);
+	kfree(pgt->shadow[0]);
+	vfree(pgt->shadow[1]);
 
 	nv_wv32(nvc0_vs(vs)->pd, pgt->pde * 8 + 0, 0);
 	nv_wv32(nvc0_vs(vs)->pd, pgt->pde * 8 + 4, 0);
@@ -144,15 +167,52 @@ nvc0_pgt_del(struct pscnv_vspace *vs, struct nvc0_pgt *pgt)
 	kfree(pgt);
 }
 
+static void
+nvc0_pgt_dirty(struct pscnv_vspace *vs, struct nvc0_pgt *pgt, int s,
+	       uint32_t pte, uint32_t count)
+{
+	if (pgt->dirty_start[s] >= pgt->dirty_end[s]) {
+		pgt->dirty_start[s] = pte;
+		pgt->dirty_end[s] = pte + count;
+	} else {
+		if (pte < pgt->dirty_start[s])
+			pgt->dirty_start[s] = pte;
+		if (pte + count > pgt->dirty_end[s])
+			pgt->dirty_end[s] = pte + count;
+	}
+	if (list_empty(&pgt->dirty))
+		list_add_tail(&pgt->dirty, &nvc0_vs(vs)->dirty);
+}
+
+/* Copies the PTEs edited since the last call from the shadows to the
+ * page tables, one memcpy_toio per table touched. Must come before the
+ * BAR and TLB flushes that make the edits visible. */
+static void
+nvc0_vspace_upload(struct pscnv_vspace *vs)
+{
+	struct nvc0_pgt *pgt, *save;
+	int s;
+
+	list_for_each_entry_safe(pgt, save, &nvc0_vs(vs)->dirty, dirty) {
+		for (s = 0; s < 2; s++) {
+			uint32_t start = pgt->dirty_start[s], end = pgt->dirty_end[s];
+			if (start < end)
+				pscnv_mem_write(pgt->bo[s], start * 8,
+					&pgt->shadow[s][start * 2], (end - start) * 8);
+			pgt->dirty_start[s] = pgt->dirty_end[s] = 0;
+		}
+		list_del_init(&pgt->dirty);
+	}
+}
+
 int
-nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
+nvc0_vspace_clear_ptes(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
 {
-	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	uint32_t space;
 
 	for (; size; offset += space) {
 		struct nvc0_pgt *pt;
-		int i, pte;
+		uint32_t pte, count;
 
 		pt = nvc0_vspace_pgt(vs, NVC0_PDE(offset));
 		space = NVC0_VM_BLOCK_SIZE - (offset & NVC0_VM_BLOCK_MASK);
@@ -161,93 +221,227 @@ nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
 		size -= space;
 
 		pte = NVC0_SPTE(offset);
-		for (i = 0; i < (space >> NVC0_SPAGE_SHIFT) * 8; i += 4)
-			nv_wv32(pt->bo[1], pte * 8 + i, 0);
+		count = space >> NVC0_SPAGE_SHIFT;
+		memset(&pt->shadow[1][pte * 2], 0, count * 8);
+		nvc0_pgt_dirty(vs, pt, 1, pte, count);
 
 		if (!pt->bo[0])
 			continue;
 
 		pte = NVC0_LPTE(offset);
-		for (i = 0; i < (space >> NVC0_LPAGE_SHIFT) * 8; i += 4)
-			nv_wv32(pt->bo[0], pte * 8 + i, 0);
+		count = space >> NVC0_LPAGE_SHIFT;
+		if (!count)
+			continue;
+		memset(&pt->shadow[0][pte * 2], 0, count * 8);
+		nvc0_pgt_dirty(vs, pt, 0, pte, count);
 	}
+	return 0;
+}
+
+int
+nvc0_vspace_flush(struct pscnv_vspace *vs)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	nvc0_vspace_upload(vs);
 	dev_priv->vm->bar_flush(vs->dev);
 	return nvc0_tlb_flush(vs);
 }
 
+int
+nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
+{
+	nvc0_vspace_clear_ptes(vs, offset, size);
+	return nvc0_vspace_flush(vs);
+}
+
 static inline void
-write_pt(struct pscnv_bo *pt, int pte, int count, uint64_t phys,
-	 int psz, uint32_t pfl0, uint32_t pfl1)
+write_pt(struct pscnv_vspace *vs, struct nvc0_pgt *pgt, int s, int pte,
+	 int count, uint64_t phys, int psz, uint32_t pfl0, uint32_t pfl1)
 {
-	int i;
+	uint32_t *p = &pgt->shadow[s][pte * 2];
 	uint32_t a = (phys >> 8) | pfl0;
 	uint32_t b = pfl1;
+	int i;
 
 	psz >>= 8;
 
-	for (i = pte * 8; i < (pte + count) * 8; i += 8, a += psz) {
-		nv_wv32(pt, i + 4, b);
-		nv_wv32(pt, i + 0, a);
+	for (i = 0; i < count; i++, a += psz) {
+		*p++ = a;
+		*p++ = b;
 	}
+	nvc0_pgt_dirty(vs, pgt, s, pte, count);
 }
 
 int
-nvc0_vspace_place_map (struct pscnv_vspace *vs, struct pscnv_bo *bo,
+nvc0_vspace_place_map (struct pscnv_vspace *vs, struct pscnv_mm *mm,
+		       struct pscnv_bo *bo, uint64_t bo_offset, uint64_t length,
 		       uint64_t start, uint64_t end, int back,
 		       struct pscnv_mm_node **res)
 {
 	int flags = 0;
 
-	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE)
+	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE) {
+		/* the slice is mapped with large PTEs only */
+		if ((bo_offset & NVC0_LPAGE_MASK) ||
+		    ((length & NVC0_LPAGE_MASK) && bo_offset + length != bo->size))
+			return -EINVAL;
 		flags = PSCNV_MM_LP;
+	}
 	if (back)
 		flags |= PSCNV_MM_FROMBACK;
 
-	return pscnv_mm_alloc(vs->mm, bo->size, flags, start, end, res);
+	return pscnv_mm_alloc(mm, length, flags, start, end, res);
 }
 
-int
-nvc0_vspace_do_map(struct pscnv_vspace *vs,
-		   struct pscnv_bo *bo, uint64_t offset)
+static void
+nvc0_vspace_pte_flags(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		      uint32_t *pfl0, uint32_t *pfl1)
+{
+	*pfl0 = 1;
+	if (vs->vid >= 0 && (bo->flags & PSCNV_GEM_NOUSER))
+		*pfl0 |= 2;
+	if (bo->flags & PSCNV_GEM_READONLY)
+		*pfl0 |= 4; /* read-only */
+
+	*pfl1 = bo->tile_flags << 4;
+
+	switch (pscnv_bo_memtype(bo)) {
+	case PSCNV_GEM_SYSRAM_NOSNOOP:
+		*pfl1 |= 0x2;
+		/* fall through */
+	case PSCNV_GEM_SYSRAM_SNOOP:
+		*pfl1 |= 0x5;
+		break;
+	}
+}
+
+/* Writes a run of small page PTEs, split at page table boundaries. With
+ * psz 0, they all point at the same page. */
+static void
+nvc0_vspace_map_sysram(struct pscnv_vspace *vs, uint64_t offset,
+		       uint64_t phys, uint64_t size, int psz,
+		       uint32_t pfl0, uint32_t pfl1)
+{
+	while (size) {
+		struct nvc0_pgt *pt;
+		uint32_t space;
+
+		space = NVC0_VM_BLOCK_SIZE -
+			(offset & NVC0_VM_BLOCK_MASK);
+		if (space > size)
+			space = size;
+		size -= space;
+
+		pt = nvc0_vspace_pgt(vs, NVC0_PDE(offset));
+		write_pt(vs, pt, 1, (offset & NVC0_VM_BLOCK_MASK) >> PAGE_SHIFT,
+			 space >> PAGE_SHIFT, phys, psz, pfl0, pfl1);
+
+		offset += space;
+		if (psz)
+			phys += space;
+	}
+}
+
+/* Points a range at the dummy page, in small pages. It is shared by
+ * every vspace, so read-only. */
+static int
+nvc0_vspace_dummy_ptes(struct pscnv_vspace *vs, uint64_t offset,
+		       uint64_t length)
 {
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+
+	nvc0_vspace_map_sysram(vs, offset, dev_priv->dummy_dma, length, 0,
+			       1 | 4, 0x5);
+	return 0;
+}
+
+/* Writes the PTEs of one sysram chunk of a BO, as far as it is inside
+ * the bo_offset..bo_offset+length slice mapped at offset: a run per DMA
+ * segment, or the dummy page if it isn't populated yet. The dummy page
+ * is shared by every client, so it is always mapped read-only. Called
+ * with the BO's sysram_lock held. */
+static void
+nvc0_vspace_map_chunk(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		      uint64_t offset, uint64_t bo_offset, uint64_t length,
+		      int chunk, uint32_t pfl0, uint32_t pfl1)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct sg_table *sgt = &bo->chunks[chunk];
+	struct scatterlist *sg;
+	uint64_t roff = (uint64_t)chunk << PSCNV_SYSRAM_CHUNK_SHIFT;
+	uint64_t end = min_t(uint64_t, bo_offset + length,
+			     roff + PSCNV_SYSRAM_CHUNK_SIZE);
+	uint64_t s, e;
+	int i;
+
+	if (!sgt->sgl) {
+		s = max_t(uint64_t, roff, bo_offset);
+		nvc0_vspace_map_sysram(vs, offset + s - bo_offset,
+			dev_priv->dummy_dma, end - s, 0, pfl0 | 4, pfl1);
+		return;
+	}
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		s = max_t(uint64_t, roff, bo_offset);
+		e = min_t(uint64_t, roff + sg_dma_len(sg), end);
+		if (s < e)
+			nvc0_vspace_map_sysram(vs, offset + s - bo_offset,
+				sg_dma_address(sg) + s - roff, e - s,
+				PAGE_SIZE, pfl0, pfl1);
+		roff += sg_dma_len(sg);
+	}
+}
+
+static int
+nvc0_vspace_remap_chunk(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+			uint64_t offset, uint64_t bo_offset, uint64_t length,
+			int chunk)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	uint32_t pfl0, pfl1;
+
+	nvc0_vspace_pte_flags(vs, bo, &pfl0, &pfl1);
+	mutex_lock(&bo->sysram_lock);
+	nvc0_vspace_map_chunk(vs, bo, offset, bo_offset, length, chunk,
+			      pfl0, pfl1);
+	mutex_unlock(&bo->sysram_lock);
+	nvc0_vspace_upload(vs);
+	dev_priv->vm->bar_flush(vs->dev);
+	return nvc0_tlb_flush(vs);
+}
+
+int
+nvc0_vspace_map_ptes(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		     uint64_t offset, uint64_t bo_offset, uint64_t length)
+{
 	uint32_t pfl0, pfl1;
 	struct pscnv_mm_node *reg;
+	uint64_t roff = 0;
 	int i;
 
-	pfl0 = 1;
-	if (vs->vid >= 0 && (bo->flags & PSCNV_GEM_NOUSER))
-		pfl0 |= 2;
-
-	pfl1 = bo->tile_flags << 4;
+	nvc0_vspace_pte_flags(vs, bo, &pfl0, &pfl1);
 
-	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
+	switch (pscnv_bo_memtype(bo)) {
 	case PSCNV_GEM_SYSRAM_NOSNOOP:
-		pfl1 |= 0x2;
-		/* fall through */
 	case PSCNV_GEM_SYSRAM_SNOOP:
-	{
-		unsigned int pde = NVC0_PDE(offset);
-		unsigned int pte = (offset & NVC0_VM_BLOCK_MASK) >> PAGE_SHIFT;
-		struct nvc0_pgt *pt = nvc0_vspace_pgt(vs, pde);
-		pfl1 |= 0x5;
-		for (i = 0; i < (bo->size >> PAGE_SHIFT); ++i) {
-			uint64_t phys = bo->dmapages[i];
-			nv_wv32(pt->bo[1], pte * 8 + 4, pfl1);
-			nv_wv32(pt->bo[1], pte * 8 + 0, (phys >> 8) | pfl0);
-			pte++;
-			if ((pte & (NVC0_VM_BLOCK_MASK >> PAGE_SHIFT)) == 0) {
-				pte = 0;
-				pt = nvc0_vspace_pgt(vs, ++pde);
-			}
-		}
-	}
+		mutex_lock(&bo->sysram_lock);
+		for (i = bo_offset >> PSCNV_SYSRAM_CHUNK_SHIFT;
+		     (uint64_t)i << PSCNV_SYSRAM_CHUNK_SHIFT < bo_offset + length; i++)
+			nvc0_vspace_map_chunk(vs, bo, offset, bo_offset, length,
+					      i, pfl0, pfl1);
+		mutex_unlock(&bo->sysram_lock);
 		break;
 	case PSCNV_GEM_VRAM_SMALL:
 	case PSCNV_GEM_VRAM_LARGE:
-		for (reg = bo->mmnode; reg; reg = reg->next) {
+		for (reg = bo->mmnode; reg && roff < bo_offset + length;
+		     roff += reg->size, reg = reg->next) {
 			uint32_t psh, psz;
-			uint64_t phys = reg->start, size = reg->size;
+			/* the part of the region inside the slice */
+			uint64_t rs = max_t(uint64_t, roff, bo_offset);
+			uint64_t re = min_t(uint64_t, roff + reg->size,
+					    bo_offset + length);
+			uint64_t phys = reg->start + rs - roff;
+			uint64_t size = rs < re ? re - rs : 0;
+			uint64_t va = offset + rs - bo_offset;
 
 			int s = (bo->flags & PSCNV_GEM_MEMTYPE_MASK) != PSCNV_GEM_VRAM_LARGE;
 			if (vs->vid == -3)
@@ -261,18 +455,18 @@ nvc0_vspace_do_map(struct pscnv_vspace *vs,
 				uint32_t space;
 
 				space = NVC0_VM_BLOCK_SIZE -
-					(offset & NVC0_VM_BLOCK_MASK);
+					(va & NVC0_VM_BLOCK_MASK);
 				if (space > size)
 					space = size;
 				size -= space;
 
-				pte = (offset & NVC0_VM_BLOCK_MASK) >> psh;
+				pte = (va & NVC0_VM_BLOCK_MASK) >> psh;
 				count = space >> psh;
-				pt = nvc0_vspace_pgt(vs, NVC0_PDE(offset));
+				pt = nvc0_vspace_pgt(vs, NVC0_PDE(va));
 
-				write_pt(pt->bo[s], pte, count, phys, psz, pfl0, pfl1);
+				write_pt(vs, pt, s, pte, count, phys, psz, pfl0, pfl1);
 
-				offset += space;
+				va += space;
 				phys += space;
 			}
 		}
@@ -280,8 +474,17 @@ nvc0_vspace_do_map(struct pscnv_vspace *vs,
 	default:
 		return -ENOSYS;
 	}
-	dev_priv->vm->bar_flush(vs->dev);
-	return nvc0_tlb_flush(vs);
+	return 0;
+}
+
+int
+nvc0_vspace_do_map(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		   uint64_t offset, uint64_t bo_offset, uint64_t length)
+{
+	int ret = nvc0_vspace_map_ptes(vs, bo, offset, bo_offset, length);
+	if (ret)
+		return ret;
+	return nvc0_vspace_flush(vs);
 }
 
 int nvc0_vspace_new(struct pscnv_vspace *vs) {
@@ -302,17 +505,16 @@ int nvc0_vspace_new(struct pscnv_vspace *vs) {
 		kfree(vs->engdata);
 		return -ENOMEM;
 	}
+	vs->pgt_bytes += nvc0_vs(vs)->pd->size;
 
 	if (vs->vid != -3)
 		nvc0_vm_map_kernel(nvc0_vs(vs)->pd);
 
-	for (i = 0; i < NVC0_VM_PDE_COUNT; i++) {
-		nv_wv32(nvc0_vs(vs)->pd, i * 8, 0);
-		nv_wv32(nvc0_vs(vs)->pd, i * 8 + 4, 0);
-	}
+	pscnv_mem_fill(nvc0_vs(vs)->pd, 0, NVC0_VM_PDE_COUNT * 8, 0);
 	
 	for (i = 0; i < NVC0_PDE_HT_SIZE; ++i)
 		INIT_LIST_HEAD(&nvc0_vs(vs)->ptht[i]);
+	INIT_LIST_HEAD(&nvc0_vs(vs)->dirty);
 
 	ret = pscnv_mm_init(vs->dev, 0, vs->size, 0x1000, 0x20000, 1, &vs->mm);
 	if (ret) {
@@ -365,6 +567,11 @@ nvc0_vm_init(struct drm_device *dev) {
 	vme->base.place_map = nvc0_vspace_place_map;
 	vme->base.do_map = nvc0_vspace_do_map;
 	vme->base.do_unmap = nvc0_vspace_do_unmap;
+	vme->base.map_ptes = nvc0_vspace_map_ptes;
+	vme->base.clear_ptes = nvc0_vspace_clear_ptes;
+	vme->base.flush = nvc0_vspace_flush;
+	vme->base.dummy_ptes = nvc0_vspace_dummy_ptes;
+	vme->base.remap_chunk = nvc0_vspace_remap_chunk;
 	vme->base.map_user = nvc0_vm_map_user;
 	vme->base.map_kernel = nvc0_vm_map_kernel;
 	vme->base.bar_flush = nv84_vm_bar_flush;
@@ -33,6 +33,12 @@ struct nvc0_pgt {
 	unsigned int pde;
 	unsigned int limit; /* virtual range = NVC0_VM_BLOCK_SIZE >> limit */
 	struct pscnv_bo *bo[2]; /* 128 KiB and 4 KiB page tables */
+	/* host copies of bo[], PTEs edited since the last upload, and
+	 * position on the vspace's dirty list. See nvc0_vspace_upload. */
+	uint32_t *shadow[2];
+	uint32_t dirty_start[2];
+	uint32_t dirty_end[2];
+	struct list_head dirty;
 };
 
 struct nvc0_vm_engine {
@@ -46,6 +52,8 @@ struct nvc0_vm_engine {
 struct nvc0_vspace {
 	struct pscnv_bo *pd;
 	struct list_head ptht[NVC0_PDE_HT_SIZE];
+	/* page tables with PTEs not uploaded yet */
+	struct list_head dirty;
 };
 
 #endif /* __NVC0_VM_H__ */
@@ -33,6 +33,7 @@
 #define NVC0_MEM_CTRLR_RAM_AMOUNT                                    0x0010f20c
 
 int nvc0_vram_alloc(struct pscnv_bo *bo);
+int nvc0_vram_alloc_batch(struct pscnv_bo **bos, int num);
 
 int
 nvc0_vram_init(struct drm_device *dev)
@@ -48,7 +49,9 @@ nvc0_vram_init(struct drm_device *dev)
 	}
 
 	dev_priv->vram->alloc = nvc0_vram_alloc;
+	dev_priv->vram->alloc_batch = nvc0_vram_alloc_batch;
 	dev_priv->vram->free = pscnv_vram_free;
+	dev_priv->vram->free_batch = pscnv_vram_free_batch;
 	dev_priv->vram->takedown = pscnv_vram_takedown;
 
 	ctrlr_num = nv_rd32(dev, NVC0_MEM_CTRLR_COUNT);
@@ -64,7 +67,7 @@ nvc0_vram_init(struct drm_device *dev)
 	NV_INFO(dev, "VRAM: size 0x%llx, %d controllers\n",
 			dev_priv->vram_size, ctrlr_num);
 
-	ret = pscnv_mm_init(dev, 0x40000, dev_priv->vram_size - 0x20000, 0x1000, 0x20000, 0x1000, &dev_priv->vram_mm);
+	ret = pscnv_vram_heaps_init(dev, 0x40000, dev_priv->vram_size - 0x20000, 0x1000, 0x20000, 0x1000, ctrlr_num);
 	if (ret) {
 		kfree(dev_priv->vram);
 		return ret;
@@ -76,10 +79,14 @@ nvc0_vram_init(struct drm_device *dev)
 int
 nvc0_vram_alloc(struct pscnv_bo *bo)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	int flags, ret;
-	switch (bo->tile_flags) {
+	return nvc0_vram_alloc_batch(&bo, 1);
+}
+
+int
+nvc0_vram_alloc_batch(struct pscnv_bo **bos, int num)
+{
+	int flags, i;
+	switch (bos[0]->tile_flags) {
 	case 0x00:
 	case 0xdb:
 	case 0xfe:
@@ -88,18 +95,14 @@ nvc0_vram_alloc(struct pscnv_bo *bo)
 	default:
 		return -EINVAL;
 	}
-	bo->size = roundup(bo->size, 0x1000);
-	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE) {
+	if ((bos[0]->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE)
 		flags |= PSCNV_MM_LP;
-		bo->size = roundup(bo->size, 0x20000);
-	}
-	if (!(bo->flags & PSCNV_GEM_CONTIG))
+	if (!(bos[0]->flags & PSCNV_GEM_CONTIG))
 		flags |= PSCNV_MM_FRAGOK;
-	mutex_lock(&dev_priv->vram_mutex);
-	ret = pscnv_mm_alloc(dev_priv->vram_mm, bo->size, flags, 0, dev_priv->vram_size, &bo->mmnode);
-	if (bo->flags & PSCNV_GEM_CONTIG)
-		bo->start = bo->mmnode->start;
-	bo->mmnode->tag = bo;
-	mutex_unlock(&dev_priv->vram_mutex);
-	return ret;
+	for (i = 0; i < num; i++) {
+		bos[i]->size = roundup(bos[i]->size, 0x1000);
+		if (flags & PSCNV_MM_LP)
+			bos[i]->size = roundup(bos[i]->size, 0x20000);
+	}
+	return pscnv_vram_alloc_nodes(bos, num, flags);
 }
@@ -0,0 +1,281 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+
+/*
+ * BO recycling. Freed BOs are kept whole, with their VRAM range or their
+ * system pages and DMA mappings, and handed out again to allocations of
+ * the same size, memory type, contig flag and tile_flags. This skips the
+ * allocator, or alloc_pages and pci_map_page for every page.
+ *
+ * The cache is bounded by the bo_cache parameter, and BOs that stay in
+ * it for PSCNV_BO_CACHE_AGE are freed for real. Cached system pages are
+ * given back under memory pressure by a shrinker, cached VRAM when a VRAM
+ * allocation fails.
+ *
+ * Like fresh ones, recycled BOs come with whatever contents they had.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+#include <linux/version.h>
+
+static int
+pscnv_bo_cache_hash(uint64_t size, int flags, int tile_flags)
+{
+	return ((size >> PAGE_SHIFT) ^ flags * 31 ^ tile_flags * 131) % PSCNV_BO_CACHE_BUCKETS;
+}
+
+static int
+pscnv_bo_cache_is_vram(struct pscnv_bo *bo)
+{
+	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
+		case PSCNV_GEM_VRAM_SMALL:
+		case PSCNV_GEM_VRAM_LARGE:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Takes a BO off the cache lists. Called with the lock held. */
+static void
+pscnv_bo_cache_unlink(struct pscnv_bo_cache *cache, struct pscnv_bo *bo)
+{
+	list_del(&bo->cache_bucket);
+	list_del(&bo->cache_lru);
+	cache->bytes -= bo->size;
+	cache->num--;
+	if (!pscnv_bo_cache_is_vram(bo))
+		cache->sysram_pages -= bo->size >> PAGE_SHIFT;
+}
+
+static void
+pscnv_bo_cache_release(struct list_head *list)
+{
+	struct pscnv_bo *bo, *tmp;
+	list_for_each_entry_safe(bo, tmp, list, cache_lru) {
+		list_del(&bo->cache_lru);
+		pscnv_mem_release(bo);
+	}
+}
+
+struct pscnv_bo *
+pscnv_bo_cache_get(struct drm_device *dev, uint64_t size, int flags, int tile_flags)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+	struct list_head *bucket = &cache->buckets[pscnv_bo_cache_hash(size, flags, tile_flags)];
+	struct pscnv_bo *bo, *res = 0;
+
+	if (!cache->enabled)
+		return 0;
+	mutex_lock(&cache->lock);
+	/* most recently freed first, it's the likeliest to be cache-hot */
+	list_for_each_entry(bo, bucket, cache_bucket) {
+		if (bo->alloc_size == size && bo->flags == flags && bo->tile_flags == tile_flags) {
+			res = bo;
+			break;
+		}
+	}
+	if (res) {
+		pscnv_bo_cache_unlink(cache, res);
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	mutex_unlock(&cache->lock);
+	return res;
+}
+
+/* Takes over a BO being freed, whose mappings are already gone. Returns 0
+ * if it doesn't qualify, and the caller has to free it. */
+int
+pscnv_bo_cache_put(struct pscnv_bo *bo)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+	uint64_t limit = (uint64_t)max(pscnv_bo_cache_size, 0) << 20;
+	struct pscnv_bo *old, *tmp;
+	LIST_HEAD(victims);
+
+	/* a single BO gets a quarter of the cache at most */
+	if (!cache->enabled || !bo->alloc_size || bo->size > limit / 4)
+		return 0;
+	/* keep the accounting simple: these get freed for real */
+	if (bo->evicted)
+		return 0;
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(old, tmp, &cache->lru, cache_lru) {
+		if (cache->bytes + bo->size <= limit)
+			break;
+		pscnv_bo_cache_unlink(cache, old);
+		list_add_tail(&old->cache_lru, &victims);
+		cache->evicted++;
+	}
+	bo->cache_time = jiffies;
+	list_add(&bo->cache_bucket, &cache->buckets[pscnv_bo_cache_hash(bo->alloc_size, bo->flags, bo->tile_flags)]);
+	list_add_tail(&bo->cache_lru, &cache->lru);
+	cache->bytes += bo->size;
+	cache->num++;
+	if (!pscnv_bo_cache_is_vram(bo))
+		cache->sysram_pages += bo->size >> PAGE_SHIFT;
+	if (cache->num == 1)
+		schedule_delayed_work(&cache->reaper, PSCNV_BO_CACHE_AGE);
+	mutex_unlock(&cache->lock);
+	pscnv_bo_cache_release(&victims);
+	return 1;
+}
+
+/* Frees all cached VRAM BOs, or all cached system memory ones. Returns
+ * the number of BOs freed. */
+int
+pscnv_bo_cache_drain(struct drm_device *dev, int vram)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+	struct pscnv_bo *bo, *tmp;
+	LIST_HEAD(victims);
+	int res = 0;
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(bo, tmp, &cache->lru, cache_lru) {
+		if (pscnv_bo_cache_is_vram(bo) != !!vram)
+			continue;
+		pscnv_bo_cache_unlink(cache, bo);
+		list_add_tail(&bo->cache_lru, &victims);
+		cache->reclaimed++;
+		res++;
+	}
+	mutex_unlock(&cache->lock);
+	pscnv_bo_cache_release(&victims);
+	return res;
+}
+
+static void
+pscnv_bo_cache_reap(struct work_struct *work)
+{
+	struct pscnv_bo_cache *cache = container_of(work, struct pscnv_bo_cache, reaper.work);
+	struct pscnv_bo *bo, *tmp;
+	LIST_HEAD(victims);
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(bo, tmp, &cache->lru, cache_lru) {
+		if (time_before(jiffies, bo->cache_time + PSCNV_BO_CACHE_AGE))
+			break;
+		pscnv_bo_cache_unlink(cache, bo);
+		list_add_tail(&bo->cache_lru, &victims);
+		cache->expired++;
+	}
+	if (cache->num)
+		schedule_delayed_work(&cache->reaper, PSCNV_BO_CACHE_AGE);
+	mutex_unlock(&cache->lock);
+	pscnv_bo_cache_release(&victims);
+}
+
+/* Gives back up to nr cached system pages, oldest BOs first, and returns
+ * how many are left. Never waits for the lock: we may be called from an
+ * allocation made with it held. */
+static int
+pscnv_bo_cache_scan(struct pscnv_bo_cache *cache, int nr)
+{
+	struct pscnv_bo *bo, *tmp;
+	LIST_HEAD(victims);
+	int res;
+
+	if (!nr)
+		return cache->sysram_pages;
+	if (!mutex_trylock(&cache->lock))
+		return -1;
+	list_for_each_entry_safe(bo, tmp, &cache->lru, cache_lru) {
+		if (nr <= 0)
+			break;
+		if (pscnv_bo_cache_is_vram(bo))
+			continue;
+		nr -= bo->size >> PAGE_SHIFT;
+		pscnv_bo_cache_unlink(cache, bo);
+		list_add_tail(&bo->cache_lru, &victims);
+		cache->reclaimed++;
+	}
+	res = cache->sysram_pages;
+	mutex_unlock(&cache->lock);
+	pscnv_bo_cache_release(&victims);
+	return res;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,0,0)
+static int
+pscnv_bo_cache_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct pscnv_bo_cache *cache = container_of(shrinker, struct pscnv_bo_cache, shrinker);
+	return pscnv_bo_cache_scan(cache, sc->nr_to_scan);
+}
+#else
+static int
+pscnv_bo_cache_shrink(struct shrinker *shrinker, int nr_to_scan, gfp_t gfp_mask)
+{
+	struct pscnv_bo_cache *cache = container_of(shrinker, struct pscnv_bo_cache, shrinker);
+	return pscnv_bo_cache_scan(cache, nr_to_scan);
+}
+#endif
+
+void
+pscnv_bo_cache_init(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+	int i;
+
+	cache->dev = dev;
+	mutex_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->lru);
+	for (i = 0; i < PSCNV_BO_CACHE_BUCKETS; i++)
+		INIT_LIST_HEAD(&cache->buckets[i]);
+	INIT_DELAYED_WORK(&cache->reaper, pscnv_bo_cache_reap);
+	cache->shrinker.shrink = pscnv_bo_cache_shrink;
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&cache->shrinker);
+	cache->enabled = (pscnv_bo_cache_size > 0);
+}
+
+/* Frees everything and stops caching: BOs freed from now on, like the
+ * ones left over at VRAM takedown, are freed for real. */
+void
+pscnv_bo_cache_takedown(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo_cache *cache = &dev_priv->bo_cache;
+
+	cache->enabled = 0;
+	unregister_shrinker(&cache->shrinker);
+	cancel_delayed_work_sync(&cache->reaper);
+	pscnv_bo_cache_drain(dev, 0);
+	pscnv_bo_cache_drain(dev, 1);
+	NV_INFO(dev, "BO cache: %lld hits, %lld misses, %lld expired, %lld evicted, %lld reclaimed\n",
+			cache->hits, cache->misses, cache->expired, cache->evicted, cache->reclaimed);
+}
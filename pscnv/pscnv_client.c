@@ -0,0 +1,204 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * Per-client memory accounting. Every drm_file gets a pscnv_client, and
+ * BOs made through gem_new or gem_userptr are charged to the client that
+ * made them until they're freed, wherever their handles went meanwhile.
+ * Imported dma-bufs are someone else's memory and aren't charged.
+ *
+ * Page tables and channels aren't BOs of the client's, and are counted
+ * on demand from the vspaces and channels its file owns.
+ *
+ * With the client_soft_limit parameter, allocations past the limit no
+ * longer compact or evict VRAM to make room, so they can't push other
+ * clients' BOs out. Past client_hard_limit, they fail with -EDQUOT.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+#include "pscnv_vm.h"
+#include "pscnv_chan.h"
+#include "pscnv_client.h"
+
+void
+pscnv_client_init(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	INIT_LIST_HEAD(&dev_priv->clients);
+	mutex_init(&dev_priv->clients_lock);
+}
+
+int
+pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *client = kzalloc(sizeof *client, GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+	kref_init(&client->ref);
+	client->dev = dev;
+	client->filp = file_priv;
+	client->pid = task_pid_nr(current);
+	get_task_comm(client->comm, current);
+	atomic64_set(&client->vram, 0);
+	atomic64_set(&client->sysram, 0);
+	client->soft_limit = (uint64_t)pscnv_client_soft_limit << 20;
+	client->hard_limit = (uint64_t)pscnv_client_hard_limit << 20;
+	mutex_lock(&dev_priv->clients_lock);
+	list_add_tail(&client->head, &dev_priv->clients);
+	mutex_unlock(&dev_priv->clients_lock);
+	file_priv->driver_priv = client;
+	return 0;
+}
+
+static void
+pscnv_client_free(struct kref *ref)
+{
+	struct pscnv_client *client = container_of(ref, struct pscnv_client, ref);
+	kfree(client);
+}
+
+void
+pscnv_client_postclose(struct drm_device *dev, struct drm_file *file_priv)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *client = file_priv->driver_priv;
+	if (!client)
+		return;
+	mutex_lock(&dev_priv->clients_lock);
+	list_del(&client->head);
+	client->filp = 0;
+	mutex_unlock(&dev_priv->clients_lock);
+	file_priv->driver_priv = 0;
+	kref_put(&client->ref, pscnv_client_free);
+}
+
+static atomic64_t *
+pscnv_client_counter(struct pscnv_client *client, struct pscnv_bo *bo)
+{
+	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
+		case PSCNV_GEM_VRAM_SMALL:
+		case PSCNV_GEM_VRAM_LARGE:
+			return &client->vram;
+		default:
+			return &client->sysram;
+	}
+}
+
+/* Returns 1 if size more bytes would put the client over its soft limit,
+ * -EDQUOT if over its hard one, 0 otherwise. A cheap check made before
+ * allocating: pscnv_client_charge has the final word. */
+int
+pscnv_client_check(struct drm_file *file_priv, uint64_t size)
+{
+	struct pscnv_client *client = file_priv->driver_priv;
+	uint64_t total;
+	if (!client)
+		return 0;
+	total = atomic64_read(&client->vram) + atomic64_read(&client->sysram) + size;
+	if (client->hard_limit && total > client->hard_limit)
+		return -EDQUOT;
+	if (client->soft_limit && total > client->soft_limit)
+		return 1;
+	return 0;
+}
+
+/* Charges a new BO to the client of file_priv, or fails with -EDQUOT if
+ * that would put it over its hard limit. */
+int
+pscnv_client_charge(struct drm_file *file_priv, struct pscnv_bo *bo)
+{
+	struct pscnv_client *client = file_priv->driver_priv;
+	atomic64_t *counter;
+	uint64_t total;
+	if (!client)
+		return 0;
+	counter = pscnv_client_counter(client, bo);
+	atomic64_add(bo->size, counter);
+	total = atomic64_read(&client->vram) + atomic64_read(&client->sysram);
+	if (client->hard_limit && total > client->hard_limit) {
+		atomic64_sub(bo->size, counter);
+		return -EDQUOT;
+	}
+	if (client->soft_limit && total > client->soft_limit && !client->soft_warned) {
+		client->soft_warned = 1;
+		NV_INFO(client->dev, "Client %d (%s) went over its soft memory limit, %lldKiB in use\n",
+				client->pid, client->comm, total >> 10);
+	}
+	kref_get(&client->ref);
+	bo->client = client;
+	return 0;
+}
+
+void
+pscnv_client_uncharge(struct pscnv_bo *bo)
+{
+	struct pscnv_client *client = bo->client;
+	if (!client)
+		return;
+	atomic64_sub(bo->size, pscnv_client_counter(client, bo));
+	bo->client = 0;
+	kref_put(&client->ref, pscnv_client_free);
+}
+
+void
+pscnv_client_usage(struct pscnv_client *client, struct pscnv_client_usage *usage)
+{
+	struct drm_nouveau_private *dev_priv = client->dev->dev_private;
+	struct pscnv_vspace *vs;
+	struct pscnv_chan *ch;
+	unsigned long flags;
+	int i;
+
+	usage->vram = atomic64_read(&client->vram);
+	usage->sysram = atomic64_read(&client->sysram);
+	usage->pgt = 0;
+	usage->chan = 0;
+	if (!client->filp || !dev_priv->vm || !dev_priv->chan)
+		return;
+
+	spin_lock_irqsave(&dev_priv->vm->vs_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(dev_priv->vm->vspaces); i++) {
+		vs = dev_priv->vm->vspaces[i];
+		if (vs && vs->filp == client->filp)
+			usage->pgt += vs->pgt_bytes;
+	}
+	spin_unlock_irqrestore(&dev_priv->vm->vs_lock, flags);
+
+	spin_lock_irqsave(&dev_priv->chan->ch_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(dev_priv->chan->chans); i++) {
+		ch = dev_priv->chan->chans[i];
+		if (!ch || ch->filp != client->filp)
+			continue;
+		usage->chan += ch->bo->size;
+		if (ch->cache)
+			usage->chan += ch->cache->size;
+	}
+	spin_unlock_irqrestore(&dev_priv->chan->ch_lock, flags);
+}
@@ -0,0 +1,72 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#ifndef __PSCNV_CLIENT_H__
+#define __PSCNV_CLIENT_H__
+
+#include <linux/kref.h>
+#include <linux/sched.h>
+
+struct pscnv_bo;
+
+/* Memory accounting of one drm_file, see pscnv_client.c. BOs hold a
+ * reference to the client they're charged to, so it can outlive the
+ * file. */
+struct pscnv_client {
+	struct kref ref;
+	struct drm_device *dev;
+	/* 0 once the file is closed */
+	struct drm_file *filp;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	/* bytes of BOs charged, by the memory type they were made with */
+	atomic64_t vram;
+	atomic64_t sysram;
+	/* on vram + sysram, in bytes, 0 for none */
+	uint64_t soft_limit;
+	uint64_t hard_limit;
+	int soft_warned;
+	/* on dev_priv->clients */
+	struct list_head head;
+};
+
+/* what pscnv_client_usage reports */
+struct pscnv_client_usage {
+	uint64_t vram;
+	uint64_t sysram;
+	uint64_t pgt;
+	uint64_t chan;
+};
+
+extern void pscnv_client_init(struct drm_device *dev);
+extern int pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv);
+extern void pscnv_client_postclose(struct drm_device *dev, struct drm_file *file_priv);
+extern int pscnv_client_check(struct drm_file *file_priv, uint64_t size);
+extern int pscnv_client_charge(struct drm_file *file_priv, struct pscnv_bo *bo);
+extern void pscnv_client_uncharge(struct pscnv_bo *bo);
+extern void pscnv_client_usage(struct pscnv_client *client, struct pscnv_client_usage *usage);
+
+#endif
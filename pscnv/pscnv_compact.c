@@ -0,0 +1,240 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * VRAM compaction. Non-contig VRAM BOs are only ever seen by the card
+ * through vspace mappings, so they can be moved around: copy the contents
+ * to a new range, point the BO at it and rewrite the PTEs of every mapping.
+ *
+ * Copies are done by the CPU through the PRAMIN window, and nothing here
+ * waits for the card: BOs must not be in use by it while they're moved.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+#include "pscnv_vm.h"
+
+int
+pscnv_vram_movable(struct pscnv_bo *bo)
+{
+	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
+		case PSCNV_GEM_VRAM_SMALL:
+		case PSCNV_GEM_VRAM_LARGE:
+			break;
+		default:
+			return 0;
+	}
+	/* contig BOs may have their address stored in hw state */
+	if (bo->flags & PSCNV_GEM_CONTIG)
+		return 0;
+	/* we can only reference and find mappings of GEM objects */
+	if (!bo->gem)
+		return 0;
+	/* already out of VRAM */
+	if (bo->evicted)
+		return 0;
+	/* tiled BOs stay at the top, where FROMBACK put them */
+	if (bo->mmnode->type == PSCNV_MM_TYPE_USED1)
+		return 0;
+	return 1;
+}
+
+/* Copy one page between VRAM and memory through the PRAMIN window. */
+void
+pscnv_vram_read_page(struct drm_device *dev, uint64_t src, uint32_t *buf)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i;
+	spin_lock(&dev_priv->pramin_lock);
+	dev_priv->pramin_start = src >> 16;
+	nv_wr32(dev, 0x1700, src >> 16);
+	for (i = 0; i < PSCNV_MEM_PAGE_SIZE / 4; i++)
+		buf[i] = nv_rd32(dev, 0x700000 + (src & 0xffff) + i * 4);
+	spin_unlock(&dev_priv->pramin_lock);
+}
+
+void
+pscnv_vram_write_page(struct drm_device *dev, uint64_t dst, const uint32_t *buf)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i;
+	spin_lock(&dev_priv->pramin_lock);
+	dev_priv->pramin_start = dst >> 16;
+	nv_wr32(dev, 0x1700, dst >> 16);
+	for (i = 0; i < PSCNV_MEM_PAGE_SIZE / 4; i++)
+		nv_wr32(dev, 0x700000 + (dst & 0xffff) + i * 4, buf[i]);
+	spin_unlock(&dev_priv->pramin_lock);
+}
+
+/* Moves a BO into a single range of its heap below its lowest node.
+ * Returns -ENOSPC if there's no such range. The caller holds a reference
+ * to its GEM object, so it can't go away meanwhile. */
+static int
+pscnv_vram_move(struct pscnv_vram_heap *heap, struct pscnv_bo *bo, uint32_t *buf)
+{
+	struct drm_device *dev = bo->dev;
+	struct pscnv_mm_node *old = bo->mmnode, *new, *n;
+	uint64_t lowest = ~0ull, dst, off;
+	uint32_t flags = 0;
+	int ret;
+
+	for (n = old; n; n = n->next)
+		if (n->start < lowest)
+			lowest = n->start;
+
+	/* movable BOs are untiled, so this is all the flags they had */
+	if ((bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE)
+		flags |= PSCNV_MM_LP;
+	mutex_lock(&heap->lock);
+	ret = pscnv_mm_alloc(heap->mm, bo->size, flags, heap->start, lowest, &new);
+	if (!ret)
+		new->tag = bo;
+	mutex_unlock(&heap->lock);
+	if (ret)
+		return -ENOSPC;
+
+	if (pscnv_mem_debug >= 1)
+		NV_INFO(dev, "Moving %d, %#llx-byte BO of type %08x to %llx\n", bo->serial, bo->size, bo->cookie, new->start);
+
+	dst = new->start;
+	for (n = old; n; n = n->next) {
+		for (off = 0; off < n->size; off += PSCNV_MEM_PAGE_SIZE) {
+			pscnv_vram_read_page(dev, n->start + off, buf);
+			pscnv_vram_write_page(dev, dst + off, buf);
+		}
+		dst += n->size;
+	}
+
+	mutex_lock(&heap->lock);
+	bo->mmnode = new;
+	mutex_unlock(&heap->lock);
+
+	/* new mappings made from now on already use the new range */
+	pscnv_vspace_remap_bo(bo);
+
+	mutex_lock(&heap->lock);
+	pscnv_mm_free(old);
+	mutex_unlock(&heap->lock);
+	return 0;
+}
+
+/* Picks the highest movable BO of the heap with a node below limit, and
+ * references it. Lock order is struct_mutex, then the heap lock: GEM
+ * objects are only freed with struct_mutex held, so one found with it
+ * held is still alive. */
+static struct pscnv_bo *
+pscnv_vram_next_movable(struct drm_device *dev, struct pscnv_vram_heap *heap, uint64_t *limit)
+{
+	struct pscnv_mm_node *node, *head;
+	struct pscnv_bo *res = 0;
+
+	mutex_lock(&dev->struct_mutex);
+	mutex_lock(&heap->lock);
+	if (*limit == ~0ull)
+		node = pscnv_mm_last(heap->mm);
+	else
+		node = pscnv_mm_find_node(heap->mm, *limit - 1);
+	for (; node; node = pscnv_mm_prev(node)) {
+		if (node->type == PSCNV_MM_TYPE_FREE || node->cached)
+			continue;
+		head = node;
+		while (head->prev)
+			head = head->prev;
+		if (head->tag && pscnv_vram_movable(head->tag)) {
+			res = head->tag;
+			*limit = node->start;
+			drm_gem_object_reference(res->gem);
+			break;
+		}
+	}
+	mutex_unlock(&heap->lock);
+	mutex_unlock(&dev->struct_mutex);
+	return res;
+}
+
+void
+pscnv_vram_flush_caches(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i;
+	for (i = 0; i < dev_priv->vram_nheaps; i++) {
+		mutex_lock(&dev_priv->vram_heaps[i].lock);
+		pscnv_mm_flush_cache(dev_priv->vram_heaps[i].mm);
+		mutex_unlock(&dev_priv->vram_heaps[i].lock);
+	}
+}
+
+/* Moves movable BOs down within their heaps, highest first, until there's
+ * a free range of at least want bytes, or until all of them were tried
+ * if want is 0. Returns the number of BOs moved, or a negative error. */
+int
+pscnv_vram_compact(struct drm_device *dev, uint64_t want)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_heap *heap;
+	uint64_t limit, before;
+	struct pscnv_bo *bo;
+	uint32_t *buf;
+	int moved = 0, ret = 0, i;
+
+	buf = kmalloc(PSCNV_MEM_PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	mutex_lock(&dev_priv->vram_compact_mutex);
+	pscnv_vram_flush_caches(dev);
+	before = pscnv_vram_largest(dev);
+
+	for (i = 0; i < dev_priv->vram_nheaps && !ret; i++) {
+		heap = &dev_priv->vram_heaps[i];
+		limit = ~0ull;
+		for (;;) {
+			if (want && pscnv_vram_largest(dev) >= want)
+				goto done;
+			bo = pscnv_vram_next_movable(dev, heap, &limit);
+			if (!bo)
+				break;
+			ret = pscnv_vram_move(heap, bo, buf);
+			drm_gem_object_unreference_unlocked(bo->gem);
+			if (!ret)
+				moved++;
+			else if (ret == -ENOSPC)
+				ret = 0;
+			else
+				break;
+		}
+	}
+
+done:
+	pscnv_vram_flush_caches(dev);
+	NV_INFO(dev, "VRAM: compaction moved %d BOs, largest free range %#llx -> %#llx\n",
+			moved, before, pscnv_vram_largest(dev));
+	mutex_unlock(&dev_priv->vram_compact_mutex);
+	kfree(buf);
+	return ret ? ret : moved;
+}
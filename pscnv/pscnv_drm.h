@@ -27,7 +27,15 @@
 #ifndef __PSCNV_DRM_H__
 #define __PSCNV_DRM_H__
 
-#define PSCNV_DRM_HEADER_PATCHLEVEL 1
+/* The driver patchlevel implementing this header, as reported by
+ * DRM_IOCTL_VERSION. Bump both on every interface addition, and note
+ * below which one brought it, so userspace can check before using it.
+ *
+ * 17: the CLIENT getparams, the LAZY, USERPTR, PRIME, ZERO and READONLY
+ *     BO flags, gem_userptr, vspace_bind, vspace_reserve/release, and
+ *     bo_offset/length in vspace_map.
+ */
+#define PSCNV_DRM_HEADER_PATCHLEVEL 17
 
 #define PSCNV_GETPARAM_PCI_VENDOR      3
 #define PSCNV_GETPARAM_PCI_DEVICE      4
@@ -36,6 +44,13 @@
 #define PSCNV_GETPARAM_CHIPSET_ID      11
 #define PSCNV_GETPARAM_GRAPH_UNITS     13
 #define PSCNV_GETPARAM_PTIMER_TIME     14
+/* memory of the calling drm file, and its limits, in bytes. Since 17 */
+#define PSCNV_GETPARAM_CLIENT_VRAM     15
+#define PSCNV_GETPARAM_CLIENT_SYSRAM   16
+#define PSCNV_GETPARAM_CLIENT_PGT      17
+#define PSCNV_GETPARAM_CLIENT_CHAN     18
+#define PSCNV_GETPARAM_CLIENT_SOFT_LIMIT 19
+#define PSCNV_GETPARAM_CLIENT_HARD_LIMIT 20
 struct drm_pscnv_getparam {
 	uint64_t param;		/* < */
 	uint64_t value;		/* > */
@@ -71,12 +86,39 @@ struct drm_pscnv_gem_info {	/* n i */
 #define PSCNV_GEM_VRAM_LARGE		0x00000008	/* VRAM with large pages */
 #define PSCNV_GEM_SYSRAM_NOSNOOP	0x0000000c
 #define PSCNV_GEM_GART			PSCNV_GEM_SYSRAM_SNOOP	/* compat */
+#define PSCNV_GEM_LAZY			0x00000020	/* sysram only: pages allocated on first
+							 * CPU touch, GPU sees a read-only page of
+							 * zeroes until then, and faults on writes.
+							 * Since 17, as are the ones below */
+#define PSCNV_GEM_USERPTR		0x00000040	/* set by gem_userptr, wraps process memory */
+#define PSCNV_GEM_PRIME			0x00000080	/* set on BOs imported from a dma-buf */
+#define PSCNV_GEM_ZERO			0x00000100	/* gem_new only: clear the BO before
+							 * handing it out */
+#define PSCNV_GEM_READONLY		0x00000200	/* gem_userptr only: pin the pages for
+							 * reading, map them read-only */
+
+/* for gem_userptr: pins a page-aligned range of the caller's memory and
+ * wraps it in a sysram BO, usable on the GPU like one made by gem_new.
+ * It can't be mmapped: use the original mapping. Since 17 */
+struct drm_pscnv_gem_userptr {	/* n */
+	uint32_t handle;	/* > */
+	uint32_t cookie;	/* < */
+	/* memory type, PSCNV_GEM_SYSRAM_SNOOP or _NOSNOOP, and optionally
+	 * PSCNV_GEM_READONLY */
+	uint32_t flags;		/* < */
+	uint32_t _pad;
+	uint64_t addr;		/* < */
+	uint64_t size;		/* < */
+	uint64_t map_handle;	/* > always 0 */
+};
 
 /* for vspace_new and vspace_free */
 struct drm_pscnv_vspace_req {	/* n f */
 	uint32_t vid;		/* > < */
 };
 
+/* a map whose start..end range lies inside a reservation is placed in
+ * it: with end - start the mapped size, at exactly start. Since 17 */
 struct drm_pscnv_vspace_map {
 	uint32_t vid;		/* < */
 	uint32_t handle;	/* < */
@@ -86,6 +128,11 @@ struct drm_pscnv_vspace_map {
 	/* none defined yet */
 	uint32_t flags;		/* < */
 	uint64_t offset;	/* > */
+	/* the part of the BO to map, page aligned. length 0 maps up to the
+	 * end of the BO. VRAM_LARGE BOs on nvc0 need both large page
+	 * aligned, but for a length that runs to the end. Since 17 */
+	uint64_t bo_offset;	/* < */
+	uint64_t length;	/* < */
 };
 
 struct drm_pscnv_vspace_unmap {
@@ -94,6 +141,55 @@ struct drm_pscnv_vspace_unmap {
 	uint64_t offset;	/* < */
 };
 
+/* one operation of vspace_bind */
+struct drm_pscnv_vspace_op {
+	uint32_t op;		/* < */
+	uint32_t handle;	/* < map only */
+	/* map: as in vspace_map. unmap: the mapping's offset */
+	uint64_t start;		/* < */
+	uint64_t end;		/* < map only */
+	uint32_t back;		/* < map only */
+	/* none defined yet */
+	uint32_t flags;		/* < */
+	uint64_t bo_offset;	/* < map only, as in vspace_map */
+	uint64_t length;	/* < map only, as in vspace_map */
+	uint64_t offset;	/* > map only */
+	/* 0, or the error that stopped the batch */
+	int32_t result;		/* > */
+	uint32_t _pad;
+};
+#define PSCNV_VSPACE_OP_MAP		1
+#define PSCNV_VSPACE_OP_UNMAP		2
+
+/* for vspace_bind: applies the ops in order, with one BAR and TLB flush
+ * at the end. Stops at the first one that fails, the ones before it
+ * staying applied. Since 17 */
+struct drm_pscnv_vspace_bind {
+	uint32_t vid;		/* < */
+	uint32_t num;		/* < at most PSCNV_VSPACE_BIND_MAX */
+	uint64_t ops;		/* < pointer to num drm_pscnv_vspace_op */
+	uint32_t done;		/* > number of ops applied */
+	uint32_t _pad;
+};
+#define PSCNV_VSPACE_BIND_MAX		0x10000
+
+/* for vspace_reserve: sets a VA range aside, for maps to be placed in
+ * later. vspace_release takes a drm_pscnv_vspace_unmap with its offset,
+ * and unmaps whatever is still mapped inside. Since 17 */
+struct drm_pscnv_vspace_reserve {
+	uint32_t vid;		/* < */
+	uint32_t flags;		/* < */
+	uint64_t size;		/* < rounded up to large pages */
+	uint64_t start;		/* < */
+	uint64_t end;		/* < */
+	uint32_t back;		/* < */
+	uint32_t _pad;
+	uint64_t offset;	/* > */
+};
+/* unmapped pages of the range point at a read-only page of zeroes
+ * shared by everyone, so reads don't fault. Writes still do. */
+#define PSCNV_VSPACE_RESV_DUMMY		0x00000001
+
 struct drm_pscnv_chan_new {
 	uint32_t vid;		/* < */
 	uint32_t cid;		/* > */
@@ -153,6 +249,11 @@ struct drm_pscnv_obj_eng_new {
 #define DRM_PSCNV_FIFO_INIT          0x29	/* Initialises PFIFO processing on a channel */
 #define DRM_PSCNV_OBJ_ENG_NEW        0x2a	/* Create a new engine object on a channel */
 #define DRM_PSCNV_FIFO_INIT_IB       0x2b	/* Initialises IB PFIFO processing on a channel */
+/* since 17 */
+#define DRM_PSCNV_GEM_USERPTR        0x2c	/* Wraps process memory in a BO */
+#define DRM_PSCNV_VSPACE_BIND        0x2d	/* Maps and unmaps many BOs in a vspace */
+#define DRM_PSCNV_VSPACE_RESERVE     0x2e	/* Sets a VA range of a vspace aside */
+#define DRM_PSCNV_VSPACE_RELEASE     0x2f	/* Frees a VA range set aside */
 
 #define DRM_IOCTL_PSCNV_GETPARAM           DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_GETPARAM, struct drm_pscnv_getparam)
 #define DRM_IOCTL_PSCNV_GEM_NEW            DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_GEM_NEW, struct drm_pscnv_gem_info)
@@ -168,5 +269,9 @@ struct drm_pscnv_obj_eng_new {
 #define DRM_IOCTL_PSCNV_FIFO_INIT          DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_FIFO_INIT, struct drm_pscnv_fifo_init)
 #define DRM_IOCTL_PSCNV_OBJ_ENG_NEW        DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_OBJ_ENG_NEW, struct drm_pscnv_obj_eng_new)
 #define DRM_IOCTL_PSCNV_FIFO_INIT_IB       DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_FIFO_INIT_IB, struct drm_pscnv_fifo_init_ib)
+#define DRM_IOCTL_PSCNV_GEM_USERPTR        DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_GEM_USERPTR, struct drm_pscnv_gem_userptr)
+#define DRM_IOCTL_PSCNV_VSPACE_BIND        DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_VSPACE_BIND, struct drm_pscnv_vspace_bind)
+#define DRM_IOCTL_PSCNV_VSPACE_RESERVE     DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_VSPACE_RESERVE, struct drm_pscnv_vspace_reserve)
+#define DRM_IOCTL_PSCNV_VSPACE_RELEASE     DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_VSPACE_RELEASE, struct drm_pscnv_vspace_unmap)
 
 #endif /* __PSCNV_DRM_H__ */
@@ -0,0 +1,215 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * VRAM eviction. When VRAM runs out, the movable BOs mapped least
+ * recently get their contents copied to system pages and all their
+ * mappings repointed there, the same way compaction moves them within
+ * VRAM. An evicted BO keeps working, only slower, and goes back to VRAM
+ * the next time it's mapped, if there's room by then.
+ *
+ * BOs mapped by the kernel count as pinned and are never evicted. Like
+ * compaction, nothing here waits for the card.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+#include "pscnv_vm.h"
+#include <linux/highmem.h>
+
+/* Marks a BO as just used: movable VRAM BOs go to the tail of the LRU. */
+void
+pscnv_vram_lru_touch(struct pscnv_bo *bo)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	if (!pscnv_vram_movable(bo))
+		return;
+	spin_lock(&dev_priv->vram_lru_lock);
+	list_move_tail(&bo->vram_lru, &dev_priv->vram_lru);
+	spin_unlock(&dev_priv->vram_lru_lock);
+}
+
+void
+pscnv_vram_lru_del(struct pscnv_bo *bo)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	spin_lock(&dev_priv->vram_lru_lock);
+	list_del_init(&bo->vram_lru);
+	spin_unlock(&dev_priv->vram_lru_lock);
+}
+
+/* Takes the least recently used unpinned BO off the LRU, and references
+ * it. As in compaction, GEM objects are only freed with struct_mutex
+ * held, and take themselves off the LRU then. */
+static struct pscnv_bo *
+pscnv_vram_lru_victim(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo *bo, *res = 0;
+
+	mutex_lock(&dev->struct_mutex);
+	spin_lock(&dev_priv->vram_lru_lock);
+	list_for_each_entry(bo, &dev_priv->vram_lru, vram_lru) {
+		if (bo->map3)
+			continue;
+		res = bo;
+		list_del_init(&bo->vram_lru);
+		drm_gem_object_reference(bo->gem);
+		break;
+	}
+	spin_unlock(&dev_priv->vram_lru_lock);
+	mutex_unlock(&dev->struct_mutex);
+	return res;
+}
+
+static int
+pscnv_vram_evict_bo(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_mm_node *old = bo->mmnode, *n;
+	struct pscnv_vram_heap *heap = pscnv_vram_heap(old);
+	uint64_t roff = 0, off;
+	void *p;
+	int ret;
+
+	ret = pscnv_sysram_alloc(bo);
+	if (ret)
+		return ret;
+
+	if (pscnv_mem_debug >= 1)
+		NV_INFO(dev, "Evicting %d, %#llx-byte BO of type %08x\n", bo->serial, bo->size, bo->cookie);
+
+	for (n = old; n; n = n->next) {
+		for (off = 0; off < n->size; off += PSCNV_MEM_PAGE_SIZE, roff += PSCNV_MEM_PAGE_SIZE) {
+			p = kmap(bo->pages[roff >> PAGE_SHIFT]);
+			pscnv_vram_read_page(dev, n->start + off, p + (roff & ~PAGE_MASK));
+			kunmap(bo->pages[roff >> PAGE_SHIFT]);
+		}
+	}
+
+	mutex_lock(&heap->lock);
+	bo->mmnode = 0;
+	bo->evicted = 1;
+	mutex_unlock(&heap->lock);
+
+	pscnv_vspace_remap_bo(bo);
+
+	mutex_lock(&heap->lock);
+	pscnv_mm_free(old);
+	mutex_unlock(&heap->lock);
+
+	dev_priv->vram_evictions++;
+	dev_priv->vram_evicted_bytes += bo->size;
+	return 0;
+}
+
+/* Evicts BOs, least recently used first, until there's a free VRAM range
+ * of at least want bytes. Returns the number of BOs evicted, or a
+ * negative error. */
+int
+pscnv_vram_evict(struct drm_device *dev, uint64_t want)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_bo *bo;
+	int evicted = 0, ret = 0;
+
+	mutex_lock(&dev_priv->vram_compact_mutex);
+	for (;;) {
+		/* freed nodes only show up in the largest range once coalesced */
+		pscnv_vram_flush_caches(dev);
+		if (pscnv_vram_largest(dev) >= want)
+			break;
+		bo = pscnv_vram_lru_victim(dev);
+		if (!bo)
+			break;
+		ret = pscnv_vram_evict_bo(bo);
+		if (ret)
+			pscnv_vram_lru_touch(bo);
+		drm_gem_object_unreference_unlocked(bo->gem);
+		if (ret)
+			break;
+		evicted++;
+	}
+	if (evicted)
+		NV_INFO(dev, "VRAM: evicted %d BOs, largest free range %#llx\n",
+				evicted, pscnv_vram_largest(dev));
+	mutex_unlock(&dev_priv->vram_compact_mutex);
+	return ret ? ret : evicted;
+}
+
+/* Brings an evicted BO back into VRAM, if it fits. The caller holds a
+ * reference, and no vspace lock. On failure the BO stays in sysram,
+ * which works just as well, so the error is only informative. */
+int
+pscnv_vram_restore(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vram_heap *heap;
+	struct pscnv_mm_node *n;
+	uint64_t roff = 0, off;
+	void *p;
+	int ret = 0;
+
+	mutex_lock(&dev_priv->vram_compact_mutex);
+	if (!bo->evicted)
+		goto out;
+	ret = dev_priv->vram->alloc_batch(&bo, 1);
+	if (ret)
+		goto out;
+
+	if (pscnv_mem_debug >= 1)
+		NV_INFO(dev, "Restoring %d, %#llx-byte BO of type %08x\n", bo->serial, bo->size, bo->cookie);
+
+	for (n = bo->mmnode; n; n = n->next) {
+		for (off = 0; off < n->size; off += PSCNV_MEM_PAGE_SIZE, roff += PSCNV_MEM_PAGE_SIZE) {
+			p = kmap(bo->pages[roff >> PAGE_SHIFT]);
+			pscnv_vram_write_page(dev, n->start + off, p + (roff & ~PAGE_MASK));
+			kunmap(bo->pages[roff >> PAGE_SHIFT]);
+		}
+	}
+
+	heap = pscnv_vram_heap(bo->mmnode);
+	mutex_lock(&heap->lock);
+	bo->evicted = 0;
+	mutex_unlock(&heap->lock);
+
+	pscnv_vspace_remap_bo(bo);
+
+	pscnv_sysram_free(bo);
+	bo->pages = 0;
+	bo->chunks = 0;
+
+	dev_priv->vram_restores++;
+	dev_priv->vram_restored_bytes += bo->size;
+	pscnv_vram_lru_touch(bo);
+out:
+	mutex_unlock(&dev_priv->vram_compact_mutex);
+	return ret;
+}
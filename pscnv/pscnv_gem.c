@@ -30,25 +30,51 @@
 #include "pscnv_gem.h"
 #include "pscnv_mem.h"
 #include "pscnv_drm.h"
+#include "pscnv_kapi.h"
 
 void pscnv_gem_free_object (struct drm_gem_object *obj) {
 	struct pscnv_bo *vo = obj->driver_private;
-	pscnv_mem_free(vo);
+#ifdef PSCNV_KAPI_DRM_GEM_PRIME
+	/* the card must be done with the exporter's pages before they're
+	 * let go, so these can't wait for the free worker */
+	if (obj->import_attach) {
+		struct sg_table *sgt = vo->import_sgt;
+		pscnv_mem_free(vo);
+		drm_prime_gem_destroy(obj, sgt);
+	} else
+#endif
+		pscnv_mem_free_deferred(vo);
 	drm_gem_object_release(obj);
 	kfree(obj);
 }
 
 struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size, uint32_t flags,
-		uint32_t tile_flags, uint32_t cookie, uint32_t *user)
+		uint32_t tile_flags, uint32_t cookie, uint32_t *user, int reclaim)
 {
-	int i;
-	struct drm_gem_object *obj;
 	struct pscnv_bo *vo;
+	int vram = ((flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_SMALL ||
+			(flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE);
 
 	vo = pscnv_mem_alloc(dev, size, flags, tile_flags, cookie);
+	if (!vo && vram && reclaim && pscnv_vram_compact_on_fail &&
+			pscnv_vram_compact(dev, size) > 0)
+		vo = pscnv_mem_alloc(dev, size, flags, tile_flags, cookie);
+	if (!vo && vram && reclaim && pscnv_vram_evict_on_fail &&
+			pscnv_vram_evict(dev, size) > 0)
+		vo = pscnv_mem_alloc(dev, size, flags, tile_flags, cookie);
 	if (!vo)
 		return 0;
 
+	return pscnv_gem_wrap(dev, vo, user);
+}
+
+/* Makes a GEM object of an existing BO, or frees the BO on failure. */
+struct drm_gem_object *pscnv_gem_wrap(struct drm_device *dev, struct pscnv_bo *vo,
+		uint32_t *user)
+{
+	int i;
+	struct drm_gem_object *obj;
+
 	obj = drm_gem_object_alloc(dev, vo->size);
 	if (!obj) {
 		pscnv_mem_free(vo);
@@ -56,6 +82,7 @@ struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size, uint
 	}
 	obj->driver_private = vo;
 	vo->gem = obj;
+	pscnv_vram_lru_touch(vo);
 
 	if (user)
 		for (i = 0; i < ARRAY_SIZE(vo->user); i++)
@@ -29,9 +29,18 @@
 
 #include "drmP.h"
 
+struct pscnv_bo;
+struct dma_buf;
+
 void pscnv_gem_free_object (struct drm_gem_object *);
 struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size,
 		uint32_t flags,	uint32_t tile_flags, uint32_t cookie,
+		uint32_t *user, int reclaim);
+struct drm_gem_object *pscnv_gem_wrap(struct drm_device *dev, struct pscnv_bo *vo,
 		uint32_t *user);
+struct dma_buf *pscnv_gem_prime_export(struct drm_device *dev, struct drm_gem_object *obj,
+		int flags);
+struct drm_gem_object *pscnv_gem_prime_import(struct drm_device *dev,
+		struct dma_buf *dma_buf);
 
 #endif
@@ -7,14 +7,18 @@
 #include "pscnv_chan.h"
 #include "pscnv_fifo.h"
 #include "pscnv_gem.h"
+#include "pscnv_client.h"
 #include "nv50_chan.h"
 #include "pscnv_kapi.h"
+#include <linux/vmalloc.h>
 
 int pscnv_ioctl_getparam(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct drm_pscnv_getparam *getparam = data;
+	struct pscnv_client *client = file_priv->driver_priv;
+	struct pscnv_client_usage usage;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
@@ -42,6 +46,32 @@ int pscnv_ioctl_getparam(struct drm_device *dev, void *data,
 	case PSCNV_GETPARAM_FB_SIZE:
 		getparam->value = dev_priv->vram_size;
 		break;
+	case PSCNV_GETPARAM_CLIENT_VRAM:
+	case PSCNV_GETPARAM_CLIENT_SYSRAM:
+	case PSCNV_GETPARAM_CLIENT_PGT:
+	case PSCNV_GETPARAM_CLIENT_CHAN:
+		if (!client)
+			return -EINVAL;
+		pscnv_client_usage(client, &usage);
+		if (getparam->param == PSCNV_GETPARAM_CLIENT_VRAM)
+			getparam->value = usage.vram;
+		else if (getparam->param == PSCNV_GETPARAM_CLIENT_SYSRAM)
+			getparam->value = usage.sysram;
+		else if (getparam->param == PSCNV_GETPARAM_CLIENT_PGT)
+			getparam->value = usage.pgt;
+		else
+			getparam->value = usage.chan;
+		break;
+	case PSCNV_GETPARAM_CLIENT_SOFT_LIMIT:
+		if (!client)
+			return -EINVAL;
+		getparam->value = client->soft_limit;
+		break;
+	case PSCNV_GETPARAM_CLIENT_HARD_LIMIT:
+		if (!client)
+			return -EINVAL;
+		getparam->value = client->hard_limit;
+		break;
 	case PSCNV_GETPARAM_GRAPH_UNITS:
 		/* NV40 and NV50 versions are quite different, but register
 		 * address is the same. User is supposed to know the card
@@ -65,16 +95,27 @@ int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
 	struct drm_pscnv_gem_info *info = data;
 	struct drm_gem_object *obj;
 	struct pscnv_bo *bo;
-	int ret;
+	int ret, over;
 
 	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
 
-	obj = pscnv_gem_new(dev, info->size, info->flags, info->tile_flags, info->cookie, info->user);
+	/* clients over their soft limit don't get to push others out */
+	over = pscnv_client_check(file_priv, info->size);
+	if (over < 0)
+		return over;
+
+	obj = pscnv_gem_new(dev, info->size, info->flags, info->tile_flags, info->cookie, info->user, !over);
 	if (!obj) {
 		return -ENOMEM;
 	}
 	bo = obj->driver_private;
 
+	ret = pscnv_client_charge(file_priv, bo);
+	if (ret) {
+		drm_gem_object_unreference_unlocked(obj);
+		return ret;
+	}
+
 	/* could change due to page size align */
 	info->size = bo->size;
 
@@ -88,6 +129,45 @@ int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
 	return ret;
 }
 
+int pscnv_ioctl_gem_userptr(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_gem_userptr *req = data;
+	struct drm_gem_object *obj;
+	struct pscnv_bo *bo;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	ret = pscnv_client_check(file_priv, req->size);
+	if (ret < 0)
+		return ret;
+
+	ret = pscnv_mem_alloc_userptr(dev, req->addr, req->size, req->flags, req->cookie, &bo);
+	if (ret)
+		return ret;
+
+	obj = pscnv_gem_wrap(dev, bo, 0);
+	if (!obj)
+		return -ENOMEM;
+
+	ret = pscnv_client_charge(file_priv, bo);
+	if (ret) {
+		drm_gem_object_unreference_unlocked(obj);
+		return ret;
+	}
+
+	ret = drm_gem_handle_create(file_priv, obj, &req->handle);
+
+	if (pscnv_gem_debug >= 1)
+		NV_INFO(dev, "GEM handle %x is userptr VO %x/%d\n", req->handle, bo->cookie, bo->serial);
+
+	/* not mmappable */
+	req->map_handle = 0;
+	drm_gem_object_handle_unreference_unlocked (obj);
+	return ret;
+}
+
 int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
@@ -197,7 +277,8 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 
 	bo = obj->driver_private;
 
-	ret = pscnv_vspace_map(vs, bo, req->start, req->end, req->back, &map);
+	ret = pscnv_vspace_map_range(vs, bo, req->bo_offset, req->length ? req->length : bo->size - req->bo_offset,
+			req->start, req->end, req->back, &map);
 	if (!ret)
 		req->offset = map->start;
 
@@ -227,6 +308,132 @@ int pscnv_ioctl_vspace_unmap(struct drm_device *dev, void *data,
 	return ret;
 }
 
+int pscnv_ioctl_vspace_bind(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_bind *req = data;
+	struct drm_pscnv_vspace_op *uops;
+	struct pscnv_vspace_op *ops;
+	struct pscnv_vspace *vs;
+	struct drm_gem_object *obj;
+	int ret = 0, num, done = 0, i;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	req->done = 0;
+	if (!req->num)
+		return 0;
+	if (req->num > PSCNV_VSPACE_BIND_MAX)
+		return -EINVAL;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	uops = vmalloc(req->num * sizeof *uops);
+	ops = vmalloc(req->num * sizeof *ops);
+	if (!uops || !ops) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (copy_from_user(uops, (void __user *)(unsigned long)req->ops, req->num * sizeof *uops)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	/* look up all the BOs first: the batch stops short at a bad op */
+	for (num = 0; num < req->num; num++) {
+		uops[num].result = 0;
+		memset(&ops[num], 0, sizeof ops[num]);
+		ops[num].start = uops[num].start;
+		if (uops[num].op == PSCNV_VSPACE_OP_UNMAP) {
+			ops[num].unmap = 1;
+			continue;
+		}
+		if (uops[num].op != PSCNV_VSPACE_OP_MAP) {
+			ret = -EINVAL;
+			break;
+		}
+		obj = drm_gem_object_lookup(dev, file_priv, uops[num].handle);
+		if (!obj) {
+			ret = -EBADF;
+			break;
+		}
+		ops[num].bo = obj->driver_private;
+		ops[num].end = uops[num].end;
+		ops[num].back = uops[num].back;
+		ops[num].bo_offset = uops[num].bo_offset;
+		ops[num].length = uops[num].length ? uops[num].length : ops[num].bo->size - uops[num].bo_offset;
+	}
+
+	if (num) {
+		int err = pscnv_vspace_bind(vs, ops, num, &done);
+		if (err)
+			ret = err;
+	}
+	for (i = 0; i < done; i++)
+		if (!ops[i].unmap)
+			uops[i].offset = ops[i].node->start;
+	if (ret && done < req->num)
+		uops[done].result = ret;
+	/* maps not done keep the references taken above */
+	for (i = done; i < num; i++)
+		if (!ops[i].unmap)
+			drm_gem_object_unreference_unlocked(ops[i].bo->gem);
+	req->done = done;
+
+	if (copy_to_user((void __user *)(unsigned long)req->ops, uops, req->num * sizeof *uops))
+		ret = -EFAULT;
+out:
+	vfree(ops);
+	vfree(uops);
+	pscnv_vspace_unref(vs);
+	return ret;
+}
+
+int pscnv_ioctl_vspace_reserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_reserve *req = data;
+	struct pscnv_vspace *vs;
+	uint64_t offset;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_reserve(vs, req->size, req->start, req->end, req->back, req->flags, &offset);
+	if (!ret)
+		req->offset = offset;
+
+	pscnv_vspace_unref(vs);
+
+	return ret;
+}
+
+int pscnv_ioctl_vspace_release(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vspace_unmap *req = data;
+	struct pscnv_vspace *vs;
+	int ret;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	vs = pscnv_get_vspace(dev, file_priv, req->vid);
+	if (!vs)
+		return -ENOENT;
+
+	ret = pscnv_vspace_release(vs, req->offset);
+
+	pscnv_vspace_unref(vs);
+
+	return ret;
+}
+
 void pscnv_vspace_cleanup(struct drm_device *dev, struct drm_file *file_priv) {
 	int vid;
 	struct pscnv_vspace *vs;
@@ -272,6 +479,8 @@ int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 		return -ENOENT;
 
 	ch = pscnv_chan_new(dev, vs, 0);
+	if (!ch && pscnv_vram_compact_on_fail && pscnv_vram_compact(dev, 0) > 0)
+		ch = pscnv_chan_new(dev, vs, 0);
 	if (!ch) {
 		pscnv_vspace_unref(vs);
 		return -ENOMEM;
@@ -458,6 +667,10 @@ struct drm_ioctl_desc nouveau_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(PSCNV_FIFO_INIT, pscnv_ioctl_fifo_init, DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(PSCNV_OBJ_ENG_NEW, pscnv_ioctl_obj_eng_new, DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(PSCNV_FIFO_INIT_IB, pscnv_ioctl_fifo_init_ib, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_GEM_USERPTR, pscnv_ioctl_gem_userptr, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_VSPACE_BIND, pscnv_ioctl_vspace_bind, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_VSPACE_RESERVE, pscnv_ioctl_vspace_reserve, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_VSPACE_RELEASE, pscnv_ioctl_vspace_release, DRM_UNLOCKED),
 };
 #elif defined(PSCNV_KAPI_DRM_IOCTL_DEF)
 struct drm_ioctl_desc nouveau_ioctls[] = {
@@ -474,6 +687,10 @@ struct drm_ioctl_desc nouveau_ioctls[] = {
 	DRM_IOCTL_DEF(DRM_PSCNV_FIFO_INIT, pscnv_ioctl_fifo_init, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_OBJ_ENG_NEW, pscnv_ioctl_obj_eng_new, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_FIFO_INIT_IB, pscnv_ioctl_fifo_init_ib, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_GEM_USERPTR, pscnv_ioctl_gem_userptr, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_BIND, pscnv_ioctl_vspace_bind, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_RESERVE, pscnv_ioctl_vspace_reserve, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VSPACE_RELEASE, pscnv_ioctl_vspace_release, DRM_UNLOCKED),
 };
 #else
 #error "Unknown IOCTLDEF method."
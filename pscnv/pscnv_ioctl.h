@@ -5,6 +5,8 @@ extern int  pscnv_ioctl_getparam(struct drm_device *, void *data,
 				   struct drm_file *);
 int pscnv_ioctl_gem_new(struct drm_device *dev, void *data,
 		struct drm_file *file_priv);
+int pscnv_ioctl_gem_userptr(struct drm_device *dev, void *data,
+		struct drm_file *file_priv);
 int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 		struct drm_file *file_priv);
 int pscnv_ioctl_vspace_new(struct drm_device *dev, void *data,
@@ -15,6 +17,12 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
 int pscnv_ioctl_vspace_unmap(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_bind(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_reserve(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vspace_release(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
 int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
 int pscnv_ioctl_chan_free(struct drm_device *dev, void *data,
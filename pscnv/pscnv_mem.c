@@ -29,9 +29,13 @@
 #include "nouveau_drv.h"
 #include "pscnv_mem.h"
 #include "pscnv_vm.h"
+#include "pscnv_client.h"
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
+#include <linux/highmem.h>
+
+static void pscnv_mem_free_work(struct work_struct *work);
 
 int
 pscnv_mem_init(struct drm_device *dev)
@@ -49,8 +53,19 @@ pscnv_mem_init(struct drm_device *dev)
 		NV_ERROR(dev, "Error setting DMA mask: %d\n", ret);
 		return ret;
 	}
+	/* sysram BOs hand out DMA segments of up to a max order block */
+	pci_set_dma_max_seg_size(dev->pdev, PAGE_SIZE << PSCNV_SYSRAM_MAX_ORDER);
+
+	mutex_init(&dev_priv->vram_compact_mutex);
+	INIT_LIST_HEAD(&dev_priv->bo_free_list);
+	spin_lock_init(&dev_priv->bo_free_lock);
+	INIT_WORK(&dev_priv->bo_free_work, pscnv_mem_free_work);
+	INIT_LIST_HEAD(&dev_priv->vram_lru);
+	spin_lock_init(&dev_priv->vram_lru_lock);
 
-	mutex_init(&dev_priv->vram_mutex);
+	ret = pscnv_sysram_init(dev);
+	if (ret)
+		return ret;
 	
 	switch (dev_priv->card_type) {
 		case NV_50:
@@ -63,8 +78,12 @@ pscnv_mem_init(struct drm_device *dev)
 			NV_ERROR(dev, "No VRAM allocator for NV%02x!\n", dev_priv->chipset);
 			ret = -ENOSYS;
 	}
-	if (ret)
+	if (ret) {
+		pscnv_sysram_takedown(dev);
 		return ret;
+	}
+
+	pscnv_bo_cache_init(dev);
 
 	dev_priv->fb_mtrr = drm_mtrr_add(pci_resource_start(dev->pdev, 1),
 					 pci_resource_len(dev->pdev, 1),
@@ -77,7 +96,10 @@ void
 pscnv_mem_takedown(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	flush_work(&dev_priv->bo_free_work);
+	pscnv_bo_cache_takedown(dev);
 	dev_priv->vram->takedown(dev);
+	pscnv_sysram_takedown(dev);
 
 	if (dev_priv->fb_mtrr >= 0) {
 		drm_mtrr_del(dev_priv->fb_mtrr, pci_resource_start(dev->pdev, 1),
@@ -90,53 +112,166 @@ struct pscnv_bo *
 pscnv_mem_alloc(struct drm_device *dev,
 		uint64_t size, int flags, int tile_flags, uint32_t cookie)
 {
-	static int serial = 0;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_bo *res;
-	int ret;
-	/* avoid all sorts of integer overflows possible otherwise. */
-	if (size >= (1ULL << 40))
-		return 0;
-	if (!size)
+	if (pscnv_mem_alloc_batch(dev, 1, &size, flags, tile_flags, cookie, &res))
 		return 0;
+	return res;
+}
 
-	res = kzalloc (sizeof *res, GFP_KERNEL);
-	if (!res)
-		return 0;
-	size = ALIGN(size, PSCNV_MEM_PAGE_SIZE);
-	size = ALIGN(size, PAGE_SIZE);
-	res->dev = dev;
-	res->size = size;
-	res->flags = flags;
-	res->tile_flags = tile_flags;
-	res->cookie = cookie;
-	res->gem = 0;
-
-	/* XXX: another mutex? */
-	mutex_lock(&dev_priv->vram_mutex);
-	res->serial = serial++;
-	mutex_unlock(&dev_priv->vram_mutex);
+static atomic_t pscnv_mem_serial = ATOMIC_INIT(0);
+
+/* Allocates num BOs of the same kind at once. For VRAM, this takes
+ * the allocator lock once and places all of them in a single pass. */
+int
+pscnv_mem_alloc_batch(struct drm_device *dev, int num, const uint64_t *sizes,
+		int flags, int tile_flags, uint32_t cookie, struct pscnv_bo **res)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int ret, i, zero;
+	if (num <= 0 || num > PSCNV_MEM_BATCH_MAX)
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		/* avoid all sorts of integer overflows possible otherwise. */
+		if (sizes[i] >= (1ULL << 40) || !sizes[i])
+			return -EINVAL;
+	}
+	if (flags & PSCNV_GEM_LAZY && ((flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_SMALL ||
+				(flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE))
+		return -EINVAL;
+	if (flags & (PSCNV_GEM_USERPTR | PSCNV_GEM_PRIME | PSCNV_GEM_READONLY))
+		return -EINVAL;
+	/* not a property of the BO, so it doesn't keep cached ones from
+	 * being reused */
+	zero = flags & PSCNV_GEM_ZERO;
+	flags &= ~PSCNV_GEM_ZERO;
+	memset(res, 0, num * sizeof *res);
+
+	/* single allocations may reuse a recently freed BO of the same kind */
+	if (num == 1) {
+		uint64_t size = ALIGN(ALIGN(sizes[0], PSCNV_MEM_PAGE_SIZE), PAGE_SIZE);
+		res[0] = pscnv_bo_cache_get(dev, size, flags, tile_flags);
+		if (res[0]) {
+			res[0]->cookie = cookie;
+			res[0]->gem = 0;
+			res[0]->map1 = 0;
+			res[0]->map3 = 0;
+			memset(res[0]->user, 0, sizeof res[0]->user);
+			res[0]->serial = atomic_inc_return(&pscnv_mem_serial) - 1;
+			if (pscnv_mem_debug >= 1)
+				NV_INFO(dev, "Reusing cached %#llx-byte BO as %d, type %08x\n",
+						size, res[0]->serial, cookie);
+			if (zero)
+				pscnv_mem_fill(res[0], 0, res[0]->size, 0);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		uint64_t size = sizes[i];
+		res[i] = kzalloc (sizeof *res[i], GFP_KERNEL);
+		if (!res[i]) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		size = ALIGN(size, PSCNV_MEM_PAGE_SIZE);
+		size = ALIGN(size, PAGE_SIZE);
+		res[i]->dev = dev;
+		res[i]->size = size;
+		res[i]->alloc_size = size;
+		INIT_LIST_HEAD(&res[i]->vram_lru);
+		res[i]->flags = flags;
+		res[i]->tile_flags = tile_flags;
+		res[i]->cookie = cookie;
+		res[i]->gem = 0;
+		res[i]->serial = atomic_inc_return(&pscnv_mem_serial) - 1;
+	}
 
 	if (pscnv_mem_debug >= 1)
-		NV_INFO(dev, "Allocating %d, %#llx-byte %sBO of type %08x, tile_flags %x\n", res->serial, size,
-				(flags & PSCNV_GEM_CONTIG ? "contig " : ""), cookie, tile_flags);
-	switch (res->flags & PSCNV_GEM_MEMTYPE_MASK) {
+		for (i = 0; i < num; i++)
+			NV_INFO(dev, "Allocating %d, %#llx-byte %sBO of type %08x, tile_flags %x\n", res[i]->serial, res[i]->size,
+					(flags & PSCNV_GEM_CONTIG ? "contig " : ""), cookie, tile_flags);
+	switch (flags & PSCNV_GEM_MEMTYPE_MASK) {
 		case PSCNV_GEM_VRAM_SMALL:
 		case PSCNV_GEM_VRAM_LARGE:
-			ret = dev_priv->vram->alloc(res);
+			ret = dev_priv->vram->alloc_batch(res, num);
+			/* cached BOs may be holding the space we need */
+			if (ret == -ENOMEM && pscnv_bo_cache_drain(dev, 1))
+				ret = dev_priv->vram->alloc_batch(res, num);
 			break;
 		case PSCNV_GEM_SYSRAM_SNOOP:
 		case PSCNV_GEM_SYSRAM_NOSNOOP:
-			ret = pscnv_sysram_alloc(res);
+			for (i = 0; i < num; i++) {
+				ret = pscnv_sysram_alloc(res[i]);
+				if (ret) {
+					while (i--)
+						pscnv_sysram_free(res[i]);
+					break;
+				}
+			}
 			break;
 		default:
 			ret = -ENOSYS;
 	}
-	if (ret) {
-		kfree(res);
+	if (ret)
+		goto fail;
+	if (zero)
+		for (i = 0; i < num; i++)
+			pscnv_mem_fill(res[i], 0, res[i]->size, 0);
+	return 0;
+
+fail:
+	for (i = 0; i < num; i++) {
+		kfree(res[i]);
+		res[i] = 0;
+	}
+	return ret;
+}
+
+/* Allocates a BO with no backing storage, for the caller to provide. */
+struct pscnv_bo *
+pscnv_mem_alloc_empty(struct drm_device *dev, uint64_t size, int flags, uint32_t cookie)
+{
+	struct pscnv_bo *bo = kzalloc (sizeof *bo, GFP_KERNEL);
+	if (!bo)
 		return 0;
+	bo->dev = dev;
+	bo->size = size;
+	bo->flags = flags;
+	bo->cookie = cookie;
+	INIT_LIST_HEAD(&bo->vram_lru);
+	bo->serial = atomic_inc_return(&pscnv_mem_serial) - 1;
+	return bo;
+}
+
+/* Wraps size bytes of the current process's memory at addr in a sysram
+ * BO, pinning the pages for its lifetime. They count against the
+ * process's RLIMIT_MEMLOCK, unless it has CAP_IPC_LOCK. */
+int
+pscnv_mem_alloc_userptr(struct drm_device *dev, uint64_t addr, uint64_t size,
+		int flags, uint32_t cookie, struct pscnv_bo **res)
+{
+	struct pscnv_bo *bo;
+	int ret;
+	if (flags & ~(PSCNV_GEM_MEMTYPE_MASK | PSCNV_GEM_READONLY))
+		return -EINVAL;
+	if ((flags & PSCNV_GEM_MEMTYPE_MASK) != PSCNV_GEM_SYSRAM_SNOOP &&
+			(flags & PSCNV_GEM_MEMTYPE_MASK) != PSCNV_GEM_SYSRAM_NOSNOOP)
+		return -EINVAL;
+	if (!size || size >= (1ULL << 40) || (addr | size) & ~PAGE_MASK)
+		return -EINVAL;
+	bo = pscnv_mem_alloc_empty(dev, size, flags | PSCNV_GEM_USERPTR, cookie);
+	if (!bo)
+		return -ENOMEM;
+	if (pscnv_mem_debug >= 1)
+		NV_INFO(dev, "Allocating %d, %#llx-byte userptr BO of type %08x at %llx\n", bo->serial, bo->size,
+				cookie, addr);
+	ret = pscnv_sysram_userptr(bo, addr);
+	if (ret) {
+		kfree(bo);
+		return ret;
 	}
-	return res;
+	*res = bo;
+	return 0;
 }
 
 int
@@ -150,10 +285,142 @@ pscnv_mem_free(struct pscnv_bo *bo)
 		pscnv_vspace_unmap_node(bo->map1);
 	if (dev_priv->vm_ok && bo->map3)
 		pscnv_vspace_unmap_node(bo->map3);
+	pscnv_vram_lru_del(bo);
+	pscnv_client_uncharge(bo);
+	bo->map1 = 0;
+	bo->map3 = 0;
+	if (pscnv_bo_cache_put(bo))
+		return 0;
+	pscnv_mem_release(bo);
+	return 0;
+}
+
+/* Copies size bytes to a VRAM BO at offset, both multiples of 4: with
+ * a single memcpy_toio through its BAR3 mapping if it has one, through
+ * PRAMIN node by node otherwise. */
+void
+pscnv_mem_write(struct pscnv_bo *bo, uint64_t offset, const void *src, uint64_t size)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	const uint32_t *p = src;
+	struct pscnv_mm_node *n;
+	uint64_t addr, len, i;
+
+	if (bo->map3 && dev_priv->vm && dev_priv->vm_ok) {
+		memcpy_toio(dev_priv->ramin + bo->map3->start - dev_priv->vm_ramin_base + offset, src, size);
+		return;
+	}
+	for (n = bo->mmnode; n && size; n = n->next) {
+		if (offset >= n->size) {
+			offset -= n->size;
+			continue;
+		}
+		addr = n->start + offset;
+		offset = n->size - offset;
+		while (size && offset) {
+			len = min_t(uint64_t, min_t(uint64_t, size, offset), 0x10000 - (addr & 0xffff));
+			spin_lock(&dev_priv->pramin_lock);
+			if (addr >> 16 != dev_priv->pramin_start) {
+				dev_priv->pramin_start = addr >> 16;
+				nv_wr32(bo->dev, 0x1700, addr >> 16);
+			}
+			for (i = 0; i < len; i += 4)
+				iowrite32_native(*p++, dev_priv->mmio + 0x700000 + (addr & 0xffff) + i);
+			spin_unlock(&dev_priv->pramin_lock);
+			addr += len;
+			offset -= len;
+			size -= len;
+		}
+		offset = 0;
+	}
+}
+
+/* Queues a GEM BO whose last reference is gone to be freed by the free
+ * worker, so that the one dropping it doesn't wait on TLB flushes and
+ * allocator locks. It's out of the eviction LRU right away, and without
+ * a GEM object compaction leaves it alone too. */
+void
+pscnv_mem_free_deferred(struct pscnv_bo *bo)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	pscnv_vram_lru_del(bo);
+	pscnv_client_uncharge(bo);
+	bo->gem = 0;
+	spin_lock(&dev_priv->bo_free_lock);
+	list_add_tail(&bo->free_entry, &dev_priv->bo_free_list);
+	spin_unlock(&dev_priv->bo_free_lock);
+	schedule_work(&dev_priv->bo_free_work);
+}
+
+/* Frees queued BOs PSCNV_MEM_FREE_BATCH at a time: BAR unmaps of a batch
+ * share a TLB flush per vspace, and its VRAM goes back with each heap
+ * locked once. */
+static void
+pscnv_mem_free_work(struct work_struct *work)
+{
+	struct drm_nouveau_private *dev_priv =
+		container_of(work, struct drm_nouveau_private, bo_free_work);
+	struct pscnv_bo *bos[PSCNV_MEM_FREE_BATCH];
+	struct pscnv_mm_node *nodes[PSCNV_MEM_FREE_BATCH * 2];
+	struct pscnv_bo *bo;
+	int num, nnodes, nvram, i;
+
+	for (;;) {
+		num = 0;
+		spin_lock(&dev_priv->bo_free_lock);
+		while (num < PSCNV_MEM_FREE_BATCH && !list_empty(&dev_priv->bo_free_list)) {
+			bo = list_first_entry(&dev_priv->bo_free_list, struct pscnv_bo, free_entry);
+			list_del(&bo->free_entry);
+			bos[num++] = bo;
+		}
+		spin_unlock(&dev_priv->bo_free_lock);
+		if (!num)
+			return;
+
+		nnodes = 0;
+		for (i = 0; i < num; i++) {
+			bo = bos[i];
+			if (pscnv_mem_debug >= 1)
+				NV_INFO(bo->dev, "Freeing %d, %#llx-byte %sBO of type %08x, tile_flags %x\n", bo->serial, bo->size,
+						(bo->flags & PSCNV_GEM_CONTIG ? "contig " : ""), bo->cookie, bo->tile_flags);
+			if (dev_priv->vm_ok && bo->map1)
+				nodes[nnodes++] = bo->map1;
+			if (dev_priv->vm_ok && bo->map3)
+				nodes[nnodes++] = bo->map3;
+			bo->map1 = 0;
+			bo->map3 = 0;
+		}
+		pscnv_vspace_unmap_nodes(nodes, nnodes);
+
+		nvram = 0;
+		for (i = 0; i < num; i++) {
+			bo = bos[i];
+			if (pscnv_bo_cache_put(bo))
+				continue;
+			if (pscnv_bo_memtype(bo) == PSCNV_GEM_VRAM_SMALL ||
+					pscnv_bo_memtype(bo) == PSCNV_GEM_VRAM_LARGE)
+				bos[nvram++] = bo;
+			else
+				pscnv_mem_release(bo);
+		}
+		dev_priv->vram->free_batch(bos, nvram);
+		for (i = 0; i < nvram; i++)
+			kfree(bos[i]);
+	}
+}
+
+/* Frees the backing storage and the BO itself, bypassing the BO cache. */
+void
+pscnv_mem_release(struct pscnv_bo *bo)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
 	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
 		case PSCNV_GEM_VRAM_SMALL:
 		case PSCNV_GEM_VRAM_LARGE:
-			dev_priv->vram->free(bo);
+			if (bo->evicted)
+				pscnv_sysram_free(bo);
+			else
+				dev_priv->vram->free(bo);
 			break;
 		case PSCNV_GEM_SYSRAM_SNOOP:
 		case PSCNV_GEM_SYSRAM_NOSNOOP:
@@ -161,19 +428,296 @@ pscnv_mem_free(struct pscnv_bo *bo)
 			break;
 	}
 	kfree (bo);
+}
+
+static void
+pscnv_mem_fill_io(void __iomem *p, uint64_t size, uint32_t val)
+{
+	uint64_t i;
+	if (val == (val & 0xff) * 0x01010101) {
+		memset_io(p, val & 0xff, size);
+		return;
+	}
+	for (i = 0; i < size; i += 4)
+		iowrite32_native(val, p + i);
+}
+
+/* PRAMIN only takes 32-bit accesses, so this is still a word at a time,
+ * but with the window moved and the lock taken once per 64kiB. */
+static void
+pscnv_mem_fill_pramin(struct drm_device *dev, uint64_t addr, uint64_t size, uint32_t val)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t len, i;
+	while (size) {
+		len = min_t(uint64_t, size, 0x10000 - (addr & 0xffff));
+		spin_lock(&dev_priv->pramin_lock);
+		if (addr >> 16 != dev_priv->pramin_start) {
+			dev_priv->pramin_start = addr >> 16;
+			nv_wr32(dev, 0x1700, addr >> 16);
+		}
+		for (i = 0; i < len; i += 4)
+			iowrite32_native(val, dev_priv->mmio + 0x700000 + (addr & 0xffff) + i);
+		spin_unlock(&dev_priv->pramin_lock);
+		addr += len;
+		size -= len;
+	}
+}
+
+/* Fills size bytes of a BO at offset with a 32-bit value, both multiples
+ * of 4. VRAM BOs are filled in one go through their BAR3 mapping if they
+ * have one, or through PRAMIN node by node otherwise. Unpopulated chunks
+ * of lazy BOs are skipped, they come in zeroed. */
+void
+pscnv_mem_fill(struct pscnv_bo *bo, uint64_t offset, uint64_t size, uint32_t val)
+{
+	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
+	struct pscnv_mm_node *n;
+	uint64_t len, i;
+	uint32_t *p;
+
+	if (pscnv_bo_memtype(bo) == PSCNV_GEM_VRAM_SMALL ||
+			pscnv_bo_memtype(bo) == PSCNV_GEM_VRAM_LARGE) {
+		if (bo->map3 && dev_priv->vm && dev_priv->vm_ok) {
+			pscnv_mem_fill_io(dev_priv->ramin + bo->map3->start - dev_priv->vm_ramin_base + offset,
+					size, val);
+			return;
+		}
+		for (n = bo->mmnode; n && size; n = n->next) {
+			if (offset >= n->size) {
+				offset -= n->size;
+				continue;
+			}
+			len = min_t(uint64_t, size, n->size - offset);
+			pscnv_mem_fill_pramin(bo->dev, n->start + offset, len, val);
+			size -= len;
+			offset = 0;
+		}
+		return;
+	}
+
+	while (size) {
+		len = min_t(uint64_t, size, PAGE_SIZE - (offset & ~PAGE_MASK));
+		if (bo->pages[offset >> PAGE_SHIFT]) {
+			p = kmap(bo->pages[offset >> PAGE_SHIFT]);
+			for (i = 0; i < len; i += 4)
+				p[((offset & ~PAGE_MASK) + i) / 4] = val;
+			kunmap(bo->pages[offset >> PAGE_SHIFT]);
+		}
+		offset += len;
+		size -= len;
+	}
+}
+
+static uint32_t
+pscnv_vram_gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Splits start..end into heaps, by default one per memory partition but
+ * no more than there are CPUs to contend on them. Boundaries are aligned
+ * to both the large page size and the LSR period, so large page and
+ * tiled allocations lose nothing to the split.
+ *
+ * With the vram_lp_buddy parameter set, the top of VRAM goes to one more
+ * heap, with the buddy backend, for untiled large page BOs only. */
+int
+pscnv_vram_heaps_init(struct drm_device *dev, uint64_t start, uint64_t end,
+		uint32_t spsize, uint32_t lpsize, uint32_t tssize, int parts)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t align = (uint64_t)lpsize / pscnv_vram_gcd(lpsize, tssize) * tssize;
+	uint64_t s, e, split = end, buddy = (uint64_t)max(pscnv_vram_lp_buddy, 0) << 20;
+	struct pscnv_vram_heap *heap;
+	int num = pscnv_vram_heaps, i, ret;
+
+	if (buddy)
+		split = rounddown(end - min(buddy, (end - start) / 2), align);
+
+	if (num <= 0) {
+		num = min_t(int, parts, num_possible_cpus());
+		while (num > 1 && (split - start) / num < PSCNV_VRAM_HEAP_MIN)
+			num--;
+	}
+	num = clamp(num, 1, PSCNV_VRAM_HEAPS_MAX - !!buddy);
+
+	s = start;
+	for (i = 0; i < num; i++) {
+		heap = &dev_priv->vram_heaps[i];
+		e = roundup(start + (split - start) / num * (i + 1), align);
+		if (i == num - 1 || e >= split)
+			e = split;
+		mutex_init(&heap->lock);
+		heap->start = s;
+		heap->end = e;
+		ret = pscnv_mm_init(dev, s, e, spsize, lpsize, tssize, &heap->mm);
+		if (ret)
+			goto fail;
+		dev_priv->vram_nheaps = i + 1;
+		if (e == split)
+			break;
+		s = e;
+	}
+
+	NV_INFO(dev, "VRAM: %d heaps of 0x%llx bytes\n", dev_priv->vram_nheaps,
+			dev_priv->vram_heaps[0].end - dev_priv->vram_heaps[0].start);
+
+	/* the buddy heap goes last, after the general ones */
+	if (split != end) {
+		heap = &dev_priv->vram_heaps[dev_priv->vram_nheaps];
+		mutex_init(&heap->lock);
+		heap->start = split;
+		heap->end = end;
+		heap->buddy = 1;
+		ret = pscnv_mm_init_buddy(dev, split, end, spsize, lpsize, tssize, &heap->mm);
+		if (ret)
+			goto fail;
+		dev_priv->vram_nheaps++;
+		NV_INFO(dev, "VRAM: large page buddy heap at %llx-%llx\n", split, end);
+	}
 	return 0;
+
+fail:
+	for (i = 0; i < dev_priv->vram_nheaps; i++)
+		pscnv_mm_takedown(dev_priv->vram_heaps[i].mm, 0);
+	dev_priv->vram_nheaps = 0;
+	return ret;
+}
+
+/* Tries one heap. If need is set, the heap is only used if it can hold
+ * a need-sized BO in one piece. */
+static int
+pscnv_vram_heap_alloc(struct pscnv_vram_heap *heap, struct pscnv_bo **bos, int num,
+		const uint64_t *sizes, uint32_t flags, uint64_t need)
+{
+	struct pscnv_mm_node *nodes[PSCNV_MEM_BATCH_MAX];
+	int ret, i;
+	mutex_lock(&heap->lock);
+	if (need && pscnv_mm_largest(heap->mm, flags) < need)
+		ret = -ENOMEM;
+	else
+		ret = pscnv_mm_alloc_batch(heap->mm, num, sizes, flags, heap->start, heap->end, nodes);
+	if (!ret) {
+		for (i = 0; i < num; i++) {
+			bos[i]->mmnode = nodes[i];
+			if (bos[i]->flags & PSCNV_GEM_CONTIG)
+				bos[i]->start = nodes[i]->start;
+			nodes[i]->tag = bos[i];
+		}
+	}
+	mutex_unlock(&heap->lock);
+	return ret;
+}
+
+/* Allocates VRAM for already sized BOs with the given PSCNV_MM_* flags.
+ * Untiled large page BOs go to the buddy heap if there's one and it has
+ * room. Otherwise, each CPU starts at its own general heap, and steals
+ * from the others in turn when that one runs out. Fragmentable BOs first
+ * look for a heap where they fit whole, and only then get fragmented. */
+int
+pscnv_vram_alloc_nodes(struct pscnv_bo **bos, int num, uint32_t flags)
+{
+	struct drm_nouveau_private *dev_priv = bos[0]->dev->dev_private;
+	int nheaps = dev_priv->vram_nheaps;
+	uint64_t sizes[PSCNV_MEM_BATCH_MAX], need = 0;
+	int home, pass, i, ret = -ENOMEM;
+	if (num > PSCNV_MEM_BATCH_MAX)
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		sizes[i] = bos[i]->size;
+		if (sizes[i] > need)
+			need = sizes[i];
+	}
+	if (dev_priv->vram_heaps[nheaps - 1].buddy) {
+		nheaps--;
+		if ((flags & PSCNV_MM_LP) && !(flags & PSCNV_MM_T1)) {
+			ret = pscnv_vram_heap_alloc(&dev_priv->vram_heaps[nheaps],
+					bos, num, sizes, flags, 0);
+			if (ret != -ENOMEM)
+				return ret;
+		}
+	}
+	home = raw_smp_processor_id() % nheaps;
+	for (pass = (flags & PSCNV_MM_FRAGOK && nheaps > 1) ? 0 : 1; pass < 2; pass++) {
+		for (i = 0; i < nheaps; i++) {
+			ret = pscnv_vram_heap_alloc(&dev_priv->vram_heaps[(home + i) % nheaps],
+					bos, num, sizes, flags, pass ? 0 : need);
+			if (ret != -ENOMEM)
+				return ret;
+		}
+	}
+	return ret;
+}
+
+struct pscnv_vram_heap *
+pscnv_vram_heap(struct pscnv_mm_node *node)
+{
+	struct drm_nouveau_private *dev_priv = node->mm->dev->dev_private;
+	int i;
+	for (i = 0; i < dev_priv->vram_nheaps; i++)
+		if (dev_priv->vram_heaps[i].mm == node->mm)
+			return &dev_priv->vram_heaps[i];
+	BUG();
+	return 0;
+}
+
+/* Largest free range in any heap. */
+uint64_t
+pscnv_vram_largest(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t res = 0, cur;
+	int i;
+	for (i = 0; i < dev_priv->vram_nheaps; i++) {
+		mutex_lock(&dev_priv->vram_heaps[i].lock);
+		cur = pscnv_mm_largest(dev_priv->vram_heaps[i].mm, 0);
+		mutex_unlock(&dev_priv->vram_heaps[i].lock);
+		if (cur > res)
+			res = cur;
+	}
+	return res;
 }
 
 int
 pscnv_vram_free(struct pscnv_bo *bo)
 {
-	struct drm_nouveau_private *dev_priv = bo->dev->dev_private;
-	mutex_lock(&dev_priv->vram_mutex);
+	struct pscnv_vram_heap *heap = pscnv_vram_heap(bo->mmnode);
+	mutex_lock(&heap->lock);
 	pscnv_mm_free(bo->mmnode);
-	mutex_unlock(&dev_priv->vram_mutex);
+	mutex_unlock(&heap->lock);
 	return 0;
 }
 
+void
+pscnv_vram_free_batch(struct pscnv_bo **bos, int num)
+{
+	struct drm_nouveau_private *dev_priv;
+	struct pscnv_vram_heap *heap;
+	int h, i;
+	if (!num)
+		return;
+	dev_priv = bos[0]->dev->dev_private;
+	for (h = 0; h < dev_priv->vram_nheaps; h++) {
+		heap = &dev_priv->vram_heaps[h];
+		for (i = 0; i < num; i++)
+			if (pscnv_vram_heap(bos[i]->mmnode) == heap)
+				break;
+		if (i == num)
+			continue;
+		mutex_lock(&heap->lock);
+		for (; i < num; i++)
+			if (pscnv_vram_heap(bos[i]->mmnode) == heap)
+				pscnv_mm_free(bos[i]->mmnode);
+		mutex_unlock(&heap->lock);
+	}
+}
+
 static void pscnv_vram_takedown_free(struct pscnv_mm_node *node) {
 	struct pscnv_bo *bo = node->tag;
 	NV_ERROR(bo->dev, "BO %d of type %08x still exists at takedown!\n",
@@ -185,5 +729,8 @@ void
 pscnv_vram_takedown(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	pscnv_mm_takedown(dev_priv->vram_mm, pscnv_vram_takedown_free);
+	int i;
+	for (i = 0; i < dev_priv->vram_nheaps; i++)
+		pscnv_mm_takedown(dev_priv->vram_heaps[i].mm, pscnv_vram_takedown_free);
+	dev_priv->vram_nheaps = 0;
 }
@@ -28,8 +28,24 @@
 #define __PSCNV_VRAM_H__
 #include "pscnv_drm.h"
 #include "pscnv_mm.h"
+#include <linux/scatterlist.h>
+
+struct pscnv_client;
 
 #define PSCNV_MEM_PAGE_SIZE 0x1000
+/* max number of BOs in one pscnv_mem_alloc_batch call */
+#define PSCNV_MEM_BATCH_MAX 16
+/* ... and freed by one pass of the free worker */
+#define PSCNV_MEM_FREE_BATCH 64
+/* VRAM is split into at most this many independently locked heaps */
+#define PSCNV_VRAM_HEAPS_MAX 8
+/* ... none of them smaller than this */
+#define PSCNV_VRAM_HEAP_MIN 0x4000000
+/* largest page order system memory BOs are built from */
+#define PSCNV_SYSRAM_MAX_ORDER 9
+/* ... and the granularity they are populated and DMA-mapped at */
+#define PSCNV_SYSRAM_CHUNK_SHIFT (PAGE_SHIFT + PSCNV_SYSRAM_MAX_ORDER)
+#define PSCNV_SYSRAM_CHUNK_SIZE (1ULL << PSCNV_SYSRAM_CHUNK_SHIFT)
 
 /* A VRAM object of any kind. */
 struct pscnv_bo {
@@ -53,31 +69,146 @@ struct pscnv_bo {
 	struct pscnv_mm_node *map3;
 	/* VRAM only: the first mm node */
 	struct pscnv_mm_node *mmnode;
-	/* SYSRaM only: list of pages */
+	/* SYSRaM only: list of pages, and the same pages as physically
+	 * contiguous runs, DMA-mapped, one table per chunk. For lazy BOs,
+	 * pages and chunks not populated yet are 0. Imported BOs have no
+	 * pages, only chunks. */
 	struct page **pages;
-	dma_addr_t *dmapages;
+	struct sg_table *chunks;
+	struct mutex sysram_lock;
+	/* number of vspace mappings, BAR ones included */
+	atomic_t vm_maps;
+	/* VRAM only: set while the contents live in sysram pages and
+	 * chunks instead, see pscnv_evict.c */
+	int evicted;
+	/* VRAM GEM objects only: position in the eviction LRU */
+	struct list_head vram_lru;
+	/* imported BOs only: the exporter's mapping, see pscnv_prime.c */
+	struct sg_table *import_sgt;
+	/* userptr BOs only: the mm their pages are charged to as locked */
+	struct mm_struct *userptr_mm;
+	/* size as asked for, before backend rounding: the BO cache key */
+	uint64_t alloc_size;
+	/* the client the BO is charged to, if any */
+	struct pscnv_client *client;
+	/* on bo_free_list, waiting to be freed */
+	struct list_head free_entry;
+	/* BO cache only, protected by its lock */
+	struct list_head cache_bucket;
+	struct list_head cache_lru;
+	unsigned long cache_time;
+};
+
+#define PSCNV_BO_CACHE_BUCKETS 64
+/* cached BOs are freed for real after this long */
+#define PSCNV_BO_CACHE_AGE HZ
+
+/* Freed BOs kept with their backing storage, for reuse by allocations
+ * of the same size and kind. See pscnv_bo_cache.c. */
+struct pscnv_bo_cache {
+	struct drm_device *dev;
+	struct mutex lock;
+	int enabled;
+	/* bytes and BOs currently cached, and system pages among them */
+	uint64_t bytes;
+	int num;
+	int sysram_pages;
+	/* least recently freed first */
+	struct list_head lru;
+	struct list_head buckets[PSCNV_BO_CACHE_BUCKETS];
+	uint64_t hits;
+	uint64_t misses;
+	/* freed for real after PSCNV_BO_CACHE_AGE, to make room, or under
+	 * memory pressure */
+	uint64_t expired;
+	uint64_t evicted;
+	uint64_t reclaimed;
+	struct delayed_work reaper;
+	struct shrinker shrinker;
 };
 
+/* A contiguous slice of VRAM with its own allocator and lock. */
+struct pscnv_vram_heap {
+	struct pscnv_mm *mm;
+	struct mutex lock;
+	uint64_t start;
+	uint64_t end;
+	/* large page buddy heap, see pscnv_mm_init_buddy */
+	int buddy;
+};
+
+/* The memory type a BO is backed by right now: evicted VRAM BOs are
+ * mapped like snooped sysram. */
+static inline int
+pscnv_bo_memtype(struct pscnv_bo *bo)
+{
+	if (bo->evicted)
+		return PSCNV_GEM_SYSRAM_SNOOP;
+	return bo->flags & PSCNV_GEM_MEMTYPE_MASK;
+}
+
 struct pscnv_vram_engine {
 	void (*takedown) (struct drm_device *);
 	int (*alloc) (struct pscnv_bo *);
+	/* all BOs share flags and tile_flags. all or nothing. */
+	int (*alloc_batch) (struct pscnv_bo **, int num);
 	int (*free) (struct pscnv_bo *);
+	/* frees the VRAM of many BOs, taking each heap lock once */
+	void (*free_batch) (struct pscnv_bo **, int num);
 };
 
 extern int pscnv_mem_init(struct drm_device *);
 extern void pscnv_mem_takedown(struct drm_device *);
 extern struct pscnv_bo *pscnv_mem_alloc(struct drm_device *,
 		uint64_t size, int flags, int tile_flags, uint32_t cookie);
+extern int pscnv_mem_alloc_batch(struct drm_device *, int num,
+		const uint64_t *sizes, int flags, int tile_flags, uint32_t cookie,
+		struct pscnv_bo **res);
+extern int pscnv_mem_alloc_userptr(struct drm_device *, uint64_t addr, uint64_t size,
+		int flags, uint32_t cookie, struct pscnv_bo **res);
+extern struct pscnv_bo *pscnv_mem_alloc_empty(struct drm_device *, uint64_t size,
+		int flags, uint32_t cookie);
 extern int pscnv_mem_free(struct pscnv_bo *);
+extern void pscnv_mem_free_deferred(struct pscnv_bo *);
+extern void pscnv_mem_release(struct pscnv_bo *);
+extern void pscnv_mem_write(struct pscnv_bo *, uint64_t offset, const void *src, uint64_t size);
+extern void pscnv_mem_fill(struct pscnv_bo *, uint64_t offset, uint64_t size, uint32_t val);
+
+extern void pscnv_bo_cache_init(struct drm_device *dev);
+extern void pscnv_bo_cache_takedown(struct drm_device *dev);
+extern struct pscnv_bo *pscnv_bo_cache_get(struct drm_device *dev, uint64_t size, int flags, int tile_flags);
+extern int pscnv_bo_cache_put(struct pscnv_bo *bo);
+extern int pscnv_bo_cache_drain(struct drm_device *dev, int vram);
 
+extern int pscnv_vram_heaps_init(struct drm_device *dev, uint64_t start, uint64_t end,
+		uint32_t spsize, uint32_t lpsize, uint32_t tssize, int parts);
+extern int pscnv_vram_alloc_nodes(struct pscnv_bo **bos, int num, uint32_t flags);
+extern struct pscnv_vram_heap *pscnv_vram_heap(struct pscnv_mm_node *node);
+extern uint64_t pscnv_vram_largest(struct drm_device *dev);
 extern int pscnv_vram_free(struct pscnv_bo *bo);
+extern void pscnv_vram_free_batch(struct pscnv_bo **bos, int num);
+extern int pscnv_vram_compact(struct drm_device *dev, uint64_t want);
+extern int pscnv_vram_movable(struct pscnv_bo *bo);
+extern void pscnv_vram_read_page(struct drm_device *dev, uint64_t src, uint32_t *buf);
+extern void pscnv_vram_write_page(struct drm_device *dev, uint64_t dst, const uint32_t *buf);
+extern void pscnv_vram_flush_caches(struct drm_device *dev);
+extern void pscnv_vram_lru_touch(struct pscnv_bo *bo);
+extern void pscnv_vram_lru_del(struct pscnv_bo *bo);
+extern int pscnv_vram_evict(struct drm_device *dev, uint64_t want);
+extern int pscnv_vram_restore(struct pscnv_bo *bo);
 extern void pscnv_vram_takedown(struct drm_device *dev);
 
 extern int nv50_vram_init(struct drm_device *);
 extern int nvc0_vram_init(struct drm_device *);
 
+extern int pscnv_sysram_init(struct drm_device *);
+extern void pscnv_sysram_takedown(struct drm_device *);
 extern int pscnv_sysram_alloc(struct pscnv_bo *);
 extern int pscnv_sysram_free(struct pscnv_bo *);
+extern int pscnv_sysram_populate(struct pscnv_bo *, int chunk);
+extern int pscnv_sysram_userptr(struct pscnv_bo *, uint64_t addr);
+extern int pscnv_sysram_build_sgt(struct pscnv_bo *, struct sg_table *, int first, int end);
 extern int pscnv_sysram_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf);
+extern void pscnv_sysram_prefault_vma(struct vm_area_struct *vma, struct pscnv_bo *bo);
 
 #endif
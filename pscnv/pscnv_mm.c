@@ -7,6 +7,21 @@
 #define TMASK 3
 #define LTMASK 1
 
+/* a single split needs at most two new nodes */
+#define PSCNV_MM_SPARE_MIN 2
+#define PSCNV_MM_SPARE_INIT 16
+#define PSCNV_MM_SPARE_MAX 64
+
+/* per class and gap type */
+#define PSCNV_MM_CACHE_MAX 16
+
+static struct kmem_cache *pscnv_mm_node_cache;
+
+static const struct pscnv_mm_backend pscnv_mm_tree_backend;
+
+/* sizes of page tables, channel objects and push buffers */
+static const uint64_t pscnv_mm_classes[PSCNV_MM_CLASSES] = { 0x1000, 0x10000, 0x100000 };
+
 static inline uint64_t
 pscnv_roundup (uint64_t x, uint32_t y)
 {
@@ -46,6 +61,64 @@ static int nodecmp(struct pscnv_mm_node *a, struct pscnv_mm_node *b) {
 
 PSCNV_RB_GENERATE_STATIC(pscnv_mm_head, pscnv_mm_node, entry, nodecmp)
 
+int pscnv_mm_cache_init(void) {
+	/* pscnv_mm_lookup may look at a node after it's been freed, so
+	 * the memory has to stay a node until an RCU grace period passes. */
+	pscnv_mm_node_cache = kmem_cache_create("pscnv_mm_node", sizeof(struct pscnv_mm_node), 0, SLAB_DESTROY_BY_RCU, NULL);
+	if (!pscnv_mm_node_cache)
+		return -ENOMEM;
+	return 0;
+}
+
+void pscnv_mm_cache_takedown(void) {
+	kmem_cache_destroy(pscnv_mm_node_cache);
+}
+
+/* Makes sure at least num spare nodes are available. This is the only
+ * place where the allocator itself allocates memory, and it is done
+ * before touching the tree, so an allocation never fails mid-split. */
+static int pscnv_mm_fill_spare(struct pscnv_mm *mm, int num) {
+	while (mm->nspare < num) {
+		struct pscnv_mm_node *node = kmem_cache_alloc(pscnv_mm_node_cache, GFP_KERNEL);
+		if (!node)
+			return -ENOMEM;
+		node->next = mm->spare;
+		mm->spare = node;
+		mm->nspare++;
+	}
+	return 0;
+}
+
+static void pscnv_mm_free_spare(struct pscnv_mm *mm) {
+	while (mm->spare) {
+		struct pscnv_mm_node *node = mm->spare;
+		mm->spare = node->next;
+		kmem_cache_free(pscnv_mm_node_cache, node);
+	}
+	mm->nspare = 0;
+}
+
+static struct pscnv_mm_node *pscnv_mm_get_node(struct pscnv_mm *mm) {
+	struct pscnv_mm_node *node = mm->spare;
+	BUG_ON(!node);
+	mm->spare = node->next;
+	mm->nspare--;
+	memset(node, 0, sizeof *node);
+	node->mm = mm;
+	return node;
+}
+
+static void pscnv_mm_put_node(struct pscnv_mm_node *node) {
+	struct pscnv_mm *mm = node->mm;
+	if (mm->nspare >= PSCNV_MM_SPARE_MAX) {
+		kmem_cache_free(pscnv_mm_node_cache, node);
+		return;
+	}
+	node->next = mm->spare;
+	mm->spare = node;
+	mm->nspare++;
+}
+
 static void pscnv_mm_getfree(struct pscnv_mm_node *node, int type, uint64_t *start, uint64_t *end) {
 	uint64_t s = node->start, e = node->start + node->size;
 	struct pscnv_mm_node *prev = PSCNV_RB_PREV(pscnv_mm_head, entry, node);
@@ -87,7 +160,8 @@ static void pscnv_mm_free_node(struct pscnv_mm_node *node) {
 		node->start = prev->start;
 		node->size += prev->size;
 		PSCNV_RB_REMOVE(pscnv_mm_head, &node->mm->head, prev);
-		kfree(prev);
+		pscnv_mm_put_node(prev);
+		node->mm->stats.merges++;
 	}
 	if (next->type == PSCNV_MM_TYPE_FREE) {
 		if (pscnv_mm_debug >= 2)
@@ -95,7 +169,8 @@ static void pscnv_mm_free_node(struct pscnv_mm_node *node) {
 		BUG_ON(node->start + node->size != next->start);
 		node->size += next->size;
 		PSCNV_RB_REMOVE(pscnv_mm_head, &node->mm->head, next);
-		kfree(next);
+		pscnv_mm_put_node(next);
+		node->mm->stats.merges++;
 	}
 	for (i = 0; i < GTYPES; i++) {
 		uint64_t s, e;
@@ -105,40 +180,132 @@ static void pscnv_mm_free_node(struct pscnv_mm_node *node) {
 	pscnv_mm_augup(node);
 }
 
-void pscnv_mm_free(struct pscnv_mm_node *node) {
+/* Returns a used node to the tree, telling the backend first. */
+static void pscnv_mm_release(struct pscnv_mm_node *node) {
+	if (node->mm->backend->release)
+		node->mm->backend->release(node);
+	pscnv_mm_free_node(node);
+}
+
+static int pscnv_mm_class(uint64_t size) {
+	int i;
+	for (i = 0; i < PSCNV_MM_CLASSES; i++)
+		if (pscnv_mm_classes[i] == size)
+			return i;
+	return -1;
+}
+
+/* Puts a freed single-node allocation of a class size on its free list
+ * instead of merging it back. The node keeps its type, so the neighbours'
+ * free space stays valid. Returns 0 if the node doesn't qualify. */
+static int pscnv_mm_cache_put(struct pscnv_mm_node *node) {
+	struct pscnv_mm *mm = node->mm;
+	int cls = pscnv_mm_class(node->size);
+	int type = node->type;
+	if (cls < 0 || node->next || node->prev)
+		return 0;
+	if (!(node->start % mm->lpsize) && !(node->size % mm->lpsize))
+		type |= PSCNV_MM_LP;
+	if (mm->ncache[cls][type] >= PSCNV_MM_CACHE_MAX)
+		return 0;
+	if (pscnv_mm_debug >= 2)
+		NV_INFO(mm->dev, "MM: Caching node %llx..%llx of type %d\n", node->start, node->start + node->size, node->type);
+	node->tag = node->tag2 = 0;
+	node->cached = 1;
+	node->next = mm->cache[cls][type];
+	mm->cache[cls][type] = node;
+	mm->ncache[cls][type]++;
+	mm->ncached++;
+	return 1;
+}
+
+static struct pscnv_mm_node *pscnv_mm_cache_get(struct pscnv_mm *mm, uint64_t size, uint32_t flags, uint64_t start, uint64_t end) {
+	int cls = pscnv_mm_class(size);
+	int type = flags & TMASK;
+	struct pscnv_mm_node *node;
+	if (cls < 0)
+		return 0;
+	node = mm->cache[cls][type];
+	/* small pages fit just as well into large page aligned space */
+	if (!node && !(type & PSCNV_MM_LP)) {
+		type |= PSCNV_MM_LP;
+		node = mm->cache[cls][type];
+	}
+	if (!node || node->start < start || node->start + node->size > end)
+		return 0;
+	if (pscnv_mm_debug >= 2)
+		NV_INFO(mm->dev, "MM: Reusing cached node %llx..%llx\n", node->start, node->start + node->size);
+	mm->cache[cls][type] = node->next;
+	mm->ncache[cls][type]--;
+	mm->ncached--;
+	node->cached = 0;
+	node->next = 0;
+	return node;
+}
+
+static void pscnv_mm_coalesce(struct pscnv_mm *mm) {
+	struct pscnv_mm_node *node;
+	int i, j;
+	for (i = 0; i < PSCNV_MM_CLASSES; i++)
+		for (j = 0; j < GTYPES; j++) {
+			while ((node = mm->cache[i][j])) {
+				mm->cache[i][j] = node->next;
+				node->next = 0;
+				node->cached = 0;
+				pscnv_mm_release(node);
+			}
+			mm->ncache[i][j] = 0;
+		}
+	mm->ncached = 0;
+}
+
+/* Merges all cached nodes back into the tree. */
+void pscnv_mm_flush_cache(struct pscnv_mm *mm) {
+	if (!mm->ncached)
+		return;
+	write_seqcount_begin(&mm->seq);
+	pscnv_mm_coalesce(mm);
+	write_seqcount_end(&mm->seq);
+}
+
+static void pscnv_mm_free_chain(struct pscnv_mm_node *node) {
 	while (node->prev)
 		node = node->prev;
 	while (node) {
 		struct pscnv_mm_node *next = node->next;
-		pscnv_mm_free_node(node);
+		pscnv_mm_release(node);
 		node = next;
 	}
 }
 
+void pscnv_mm_free(struct pscnv_mm_node *node) {
+	struct pscnv_mm *mm = node->mm;
+	mm->stats.frees++;
+	write_seqcount_begin(&mm->seq);
+	if (!pscnv_mm_cache_put(node))
+		pscnv_mm_free_chain(node);
+	write_seqcount_end(&mm->seq);
+}
+
 int pscnv_mm_init(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t spsize, uint32_t lpsize, uint32_t tssize, struct pscnv_mm **res) {
 	struct pscnv_mm *mm = kzalloc(sizeof *mm, GFP_KERNEL);
 	struct pscnv_mm_node *ss, *se, *node;
 	if (!mm)
 		return -ENOMEM;
-	if (!(ss = kzalloc(sizeof *ss, GFP_KERNEL))) {
-		kfree(mm);
-		return -ENOMEM;
-	}
-	if (!(se = kzalloc(sizeof *se, GFP_KERNEL))) {
-		kfree(ss);
-		kfree(mm);
-		return -ENOMEM;
-	}
-	if (!(node = kzalloc(sizeof *node, GFP_KERNEL))) {
-		kfree(se);
-		kfree(ss);
+	if (pscnv_mm_fill_spare(mm, 3 + PSCNV_MM_SPARE_INIT)) {
+		pscnv_mm_free_spare(mm);
 		kfree(mm);
 		return -ENOMEM;
 	}
+	ss = pscnv_mm_get_node(mm);
+	se = pscnv_mm_get_node(mm);
+	node = pscnv_mm_get_node(mm);
 	mm->dev = dev;
 	mm->spsize = spsize;
 	mm->lpsize = lpsize;
 	mm->tssize = tssize;
+	mm->backend = &pscnv_mm_tree_backend;
+	seqcount_init(&mm->seq);
 	ss->type = se->type = PSCNV_MM_TYPE_USED0;
 	ss->sentinel = -1;
 	se->sentinel = 1;
@@ -146,7 +313,6 @@ int pscnv_mm_init(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t
 	se->start = end;
 	node->start = start;
 	node->size = end - start;
-	node->mm = ss->mm = se->mm = mm;
 	PSCNV_RB_INSERT(pscnv_mm_head, &mm->head, ss);
 	PSCNV_RB_INSERT(pscnv_mm_head, &mm->head, node);
 	PSCNV_RB_INSERT(pscnv_mm_head, &mm->head, se);
@@ -158,6 +324,8 @@ int pscnv_mm_init(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t
 void pscnv_mm_takedown(struct pscnv_mm *mm, void (*free_callback)(struct pscnv_mm_node *)) {
 	struct pscnv_mm_node *cur;
 restart:
+	/* the callback may have put its nodes on the free lists */
+	pscnv_mm_flush_cache(mm);
 	cur = PSCNV_RB_MIN(pscnv_mm_head, &mm->head);
 	cur = PSCNV_RB_NEXT(pscnv_mm_head, entry, cur);
 	while (cur->type == PSCNV_MM_TYPE_FREE)
@@ -172,136 +340,550 @@ restart:
 	}
 	while ((cur = PSCNV_RB_ROOT(&mm->head))) {
 		PSCNV_RB_REMOVE(pscnv_mm_head, &mm->head, cur);
-		kfree(cur);
+		kmem_cache_free(pscnv_mm_node_cache, cur);
 	}
+	pscnv_mm_free_spare(mm);
+	if (mm->backend->takedown)
+		mm->backend->takedown(mm);
 	kfree(mm);
 }
 
-static int pscnv_mm_alloc_single(struct pscnv_mm_node *node, uint64_t size, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
-	struct pscnv_mm_node *left = PSCNV_RB_LEFT(node, entry), *right = PSCNV_RB_RIGHT(node, entry);
-	uint64_t minsz = ((flags & PSCNV_MM_FRAGOK) ? 1 : size);
-	int lok = left && left->maxgap[flags & TMASK] >= minsz && node->start > start;
-	int rok = right && right->maxgap[flags & TMASK] >= minsz && node->start + node->size < end;
-	int back = flags & PSCNV_MM_FROMBACK;
-	uint64_t s, e;
+/* Carves s..e out of free node, which becomes the used node covering it.
+ * Whatever remains on either side is split off into new free nodes. */
+static struct pscnv_mm_node *pscnv_mm_take(struct pscnv_mm_node *node, uint64_t s, uint64_t e, uint32_t flags) {
 	struct pscnv_mm_node *lsp = 0, *rsp = 0;
 	int i;
 
-	if (!back && lok && !pscnv_mm_alloc_single(left, size, flags, start, end, res))
-		return 0;
-	if (back && rok && !pscnv_mm_alloc_single(right, size, flags, start, end, res))
-		return 0;
+	if (pscnv_mm_debug >= 2)
+		NV_INFO(node->mm->dev, "MM: Using node %llx..%llx, space %llx..%llx\n", node->start, node->start + node->size, s, e);
+
+	/* spares were reserved by pscnv_mm_alloc_batch */
+	if (s != node->start)
+		lsp = pscnv_mm_get_node(node->mm);
+	if (e != node->start + node->size)
+		rsp = pscnv_mm_get_node(node->mm);
+	if (lsp || rsp)
+		node->mm->stats.splits++;
+
+	node->type = flags & LTMASK;
+	for (i = 0; i < GTYPES; i++)
+		node->gap[i] = 0;
+	pscnv_mm_augup(node);
 
-	if (node->type == PSCNV_MM_TYPE_FREE) {
-		pscnv_mm_getfree(node, flags & TMASK, &s, &e);
-		if (start > s)
-			s = start;
-		if (end < e)
-			e = end;
-		if (e < s)
-			e = s;
-		if (e-s >= minsz) {
-			if (pscnv_mm_debug >= 2)
-				NV_INFO(node->mm->dev, "MM: Using node %llx..%llx, space %llx..%llx\n", node->start, node->start + node->size, s, e);
+	if (lsp) {
+		lsp->start = node->start;
+		lsp->size = s - node->start;
+		node->size -= lsp->size;
+		node->start = s;
+		PSCNV_RB_INSERT(pscnv_mm_head, &node->mm->head, lsp);
+		pscnv_mm_free_node(lsp);
+	}
+
+	if (rsp) {
+		rsp->start = e;
+		rsp->size = node->start + node->size - e;
+		node->size -= rsp->size;
+		PSCNV_RB_INSERT(pscnv_mm_head, &node->mm->head, rsp);
+		pscnv_mm_free_node(rsp);
+	}
+	if (pscnv_mm_debug >= 2)
+		NV_INFO(node->mm->dev, "MM: After split: %llx..%llx\n", node->start, node->start + node->size);
+	return node;
+}
+
+/* Returns the first node of the subtree, or the last one with back set,
+ * whose gap is at least minsz. The subtree's maxgap must allow it. */
+static struct pscnv_mm_node *pscnv_mm_fit_down(struct pscnv_mm_node *node, int type, uint64_t minsz, int back) {
+	for (;;) {
+		struct pscnv_mm_node *near = back ? PSCNV_RB_RIGHT(node, entry) : PSCNV_RB_LEFT(node, entry);
+		if (near && near->maxgap[type] >= minsz)
+			node = near;
+		else if (node->gap[type] >= minsz)
+			return node;
+		else
+			node = back ? PSCNV_RB_LEFT(node, entry) : PSCNV_RB_RIGHT(node, entry);
+	}
+}
+
+/* Returns the first node after the given one, or the last one before it
+ * with back set, whose gap is at least minsz. Subtrees that cannot hold
+ * minsz are skipped using maxgap, so this is logarithmic, not linear. */
+static struct pscnv_mm_node *pscnv_mm_fit_next(struct pscnv_mm_node *node, int type, uint64_t minsz, int back) {
+	struct pscnv_mm_node *parent, *far;
+	far = back ? PSCNV_RB_LEFT(node, entry) : PSCNV_RB_RIGHT(node, entry);
+	if (far && far->maxgap[type] >= minsz)
+		return pscnv_mm_fit_down(far, type, minsz, back);
+	while ((parent = PSCNV_RB_PARENT(node, entry))) {
+		if (node == (back ? PSCNV_RB_RIGHT(parent, entry) : PSCNV_RB_LEFT(parent, entry))) {
+			if (parent->gap[type] >= minsz)
+				return parent;
+			far = back ? PSCNV_RB_LEFT(parent, entry) : PSCNV_RB_RIGHT(parent, entry);
+			if (far && far->maxgap[type] >= minsz)
+				return pscnv_mm_fit_down(far, type, minsz, back);
+		}
+		node = parent;
+	}
+	return 0;
+}
+
+/* Returns the last node starting at or before addr, or the start sentinel
+ * if there's none. */
+static struct pscnv_mm_node *pscnv_mm_floor(struct pscnv_mm *mm, uint64_t addr) {
+	struct pscnv_mm_node *node = PSCNV_RB_ROOT(&mm->head), *res = 0;
+	while (node) {
+		if (node->start <= addr) {
+			res = node;
+			node = PSCNV_RB_RIGHT(node, entry);
+		} else {
+			node = PSCNV_RB_LEFT(node, entry);
+		}
+	}
+	if (!res)
+		res = PSCNV_RB_MIN(pscnv_mm_head, &mm->head);
+	return res;
+}
+
+/* Free space of the node usable for the given type, within start..end. */
+static void pscnv_mm_space(struct pscnv_mm_node *node, int type, uint64_t start, uint64_t end, uint64_t *s, uint64_t *e) {
+	pscnv_mm_getfree(node, type, s, e);
+	if (start > *s)
+		*s = start;
+	if (end < *e)
+		*e = end;
+	if (*e < *s)
+		*e = *s;
+}
+
+/* Returns the given node if it has minsz of usable space, otherwise the
+ * first one after it [or before it with back] that has. */
+static struct pscnv_mm_node *pscnv_mm_first_fit(struct pscnv_mm_node *node, uint64_t minsz, int type, int back, uint64_t start, uint64_t end, uint64_t *s, uint64_t *e) {
+	if (node->gap[type] < minsz)
+		node = pscnv_mm_fit_next(node, type, minsz, back);
+	while (node && !(back ? node->start + node->size <= start : node->start >= end)) {
+		pscnv_mm_space(node, type, start, end, s, e);
+		if (*e - *s >= minsz)
+			return node;
+		node = pscnv_mm_fit_next(node, type, minsz, back);
+	}
+	return 0;
+}
+
+/* Returns the node with the smallest usable space that still holds size.
+ * Only subtrees with a large enough maxgap are visited, and an exact fit
+ * ends the search early. */
+static struct pscnv_mm_node *pscnv_mm_best_fit(struct pscnv_mm *mm, uint64_t size, int type, int back, uint64_t start, uint64_t end, uint64_t *bs, uint64_t *be) {
+	struct pscnv_mm_node *node = pscnv_mm_floor(mm, back && end ? end - 1 : start), *best = 0;
+	uint64_t s, e;
+	while ((node = pscnv_mm_first_fit(node, size, type, back, start, end, &s, &e))) {
+		if (!best || e - s < *be - *bs) {
+			best = node;
+			*bs = s;
+			*be = e;
+			if (e - s == size)
+				break;
+		}
+		node = pscnv_mm_fit_next(node, type, size, back);
+		if (!node)
+			break;
+	}
+	return best;
+}
+
+static int pscnv_mm_walk(struct pscnv_mm *mm, int num, const uint64_t *sizes, uint32_t flags, uint32_t psize, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
+	int type = flags & TMASK;
+	int back = flags & PSCNV_MM_FROMBACK;
+	struct pscnv_mm_node *cur, *last = 0;
+	int i, ret;
+	cur = pscnv_mm_floor(mm, back && end ? end - 1 : start);
+	for (i = 0; i < num; i++) {
+		uint64_t size = pscnv_roundup(sizes[i], psize);
+		if (pscnv_mm_debug >= 1)
+			NV_INFO(mm->dev, "MM: Allocation size %llx at %llx..%llx flags %d\n", size, start, end, flags);
+		last = 0;
+		while (size) {
+			uint64_t minsz = ((flags & PSCNV_MM_FRAGOK) ? 1 : size);
+			struct pscnv_mm_node *node = 0;
+			uint64_t s, e;
+			if (flags & PSCNV_MM_BESTFIT)
+				node = pscnv_mm_best_fit(mm, size, type, back, start, end, &s, &e);
+			/* best fit only falls back to fragments in address order */
+			if (!node && (!(flags & PSCNV_MM_BESTFIT) || (flags & PSCNV_MM_FRAGOK)))
+				node = pscnv_mm_first_fit(cur, minsz, type, back, start, end, &s, &e);
+			if (!node) {
+				ret = -ENOMEM;
+				goto fail;
+			}
 			if (e-s > size) {
 				if (back)
 					s = e - size;
 				else
 					e = s + size;
 			}
-
-			if (s != node->start) {
-				lsp = kzalloc(sizeof *lsp, GFP_KERNEL);
-				if (!lsp)
-					return -ENOMEM;
-			}
-			if (e != node->start + node->size) {
-				rsp = kzalloc(sizeof *rsp, GFP_KERNEL);
-				if (!rsp) {
-					if (lsp)
-						kfree(lsp);
-					return -ENOMEM;
-				}
-			}
-
-			node->type = flags & LTMASK;
-			for (i = 0; i < GTYPES; i++)
-				node->gap[i] = 0;
-			pscnv_mm_augup(node);
-
-			if (lsp) {
-				lsp->mm = node->mm;
-				lsp->start = node->start;
-				lsp->size = s - node->start;
-				node->size -= lsp->size;
-				node->start = s;
-				PSCNV_RB_INSERT(pscnv_mm_head, &node->mm->head, lsp);
-				pscnv_mm_free_node(lsp);
-			}
-
-			if (rsp) {
-				rsp->mm = node->mm;
-				rsp->start = e;
-				rsp->size = node->start + node->size - e;
-				node->size -= rsp->size;
-				PSCNV_RB_INSERT(pscnv_mm_head, &node->mm->head, rsp);
-				pscnv_mm_free_node(rsp);
+			ret = pscnv_mm_fill_spare(mm, PSCNV_MM_SPARE_MIN);
+			if (ret)
+				goto fail;
+			cur = pscnv_mm_take(node, s, e, flags);
+			size -= cur->size;
+			cur->next = 0;
+			if (last) {
+				last->next = cur;
+				cur->prev = last;
+			} else {
+				res[i] = cur;
+				cur->prev = 0;
 			}
-			if (pscnv_mm_debug >= 2)
-				NV_INFO(node->mm->dev, "MM: After split: %llx..%llx\n", node->start, node->start + node->size);
-
-			*res = node;
-			return 0;
+			last = cur;
 		}
 	}
+	return 0;
 
-	if (back && lok && !pscnv_mm_alloc_single(left, size, flags, start, end, res))
-		return 0;
-	if (!back && rok && !pscnv_mm_alloc_single(right, size, flags, start, end, res))
-		return 0;
-	return -ENOMEM;
+fail:
+	if (last)
+		pscnv_mm_free_chain(last);
+	res[i] = 0;
+	while (i--) {
+		if (res[i])
+			pscnv_mm_free_chain(res[i]);
+		res[i] = 0;
+	}
+	return ret;
 }
 
-int pscnv_mm_alloc(struct pscnv_mm *mm, uint64_t size, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
+static const struct pscnv_mm_backend pscnv_mm_tree_backend = {
+	.name = "tree",
+	.alloc = pscnv_mm_walk,
+};
+
+/* Allocates num ranges of the given sizes in one in-order walk of the tree,
+ * or as the mm's backend sees fit, see pscnv_mm_init_buddy.
+ * Ranges are placed in order, each after the previous one, or before it
+ * with PSCNV_MM_FROMBACK. With PSCNV_MM_FRAGOK, each range may come as
+ * a chain of fragments. Either all ranges are allocated, or none is.
+ *
+ * With PSCNV_MM_BESTFIT, set in flags or in the mm's policy, each range
+ * goes to the smallest free space that holds it whole instead, wherever
+ * that is. Only ranges that fit nowhere whole are fragmented.
+ *
+ * A single range of a class size is taken from the class free list when
+ * possible, without looking at the tree. Cached nodes are merged back
+ * only when the walk fails. PSCNV_MM_FROMBACK allocations skip the free
+ * lists, which don't keep track of where their nodes lie, and always get
+ * the top-down placement of the walk. */
+int pscnv_mm_alloc_batch(struct pscnv_mm *mm, int num, const uint64_t *sizes, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
 	uint32_t psize;
-	struct pscnv_mm_node *last = 0;
-	int ret;
+	int i, ret;
+	flags |= mm->policy;
 	if (flags & PSCNV_MM_LP)
 		psize = mm->lpsize;
 	else
 		psize = mm->spsize;
-	size = pscnv_roundup(size, psize);
 	start = pscnv_roundup(start, psize);
 	end = pscnv_rounddown(end, psize);
-	/* avoid various bounduary conditions */
-	if (size > (1ull << 60))
-		return -EINVAL;
-	if (pscnv_mm_debug >= 1)
-		NV_INFO(mm->dev, "MM: Allocation size %llx at %llx..%llx flags %d\n", size, start, end, flags);
-	while (size) {
-		struct pscnv_mm_node *cur;
-		ret = pscnv_mm_alloc_single(PSCNV_RB_ROOT(&mm->head), size, flags, start, end, &cur);
-		if (ret) {
-			while (last) {
-				cur = last->prev;
-				pscnv_mm_free_node(last);
-				last = cur;
-			}
-			return ret;
-		}
-		size -= cur->size;
-		if (last) {
-			last->next = cur;
-			cur->prev = last;
-			last = cur;
-		} else {
-			*res = last = cur;
-			cur->prev = 0;
+	for (i = 0; i < num; i++) {
+		/* avoid various bounduary conditions */
+		if (sizes[i] > (1ull << 60))
+			return -EINVAL;
+		res[i] = 0;
+	}
+	if (end <= start)
+		end = start;
+	write_seqcount_begin(&mm->seq);
+	if (num == 1 && mm->ncached && !(flags & PSCNV_MM_FROMBACK)) {
+		res[0] = pscnv_mm_cache_get(mm, pscnv_roundup(sizes[0], psize), flags, start, end);
+		if (res[0]) {
+			write_seqcount_end(&mm->seq);
+			mm->stats.allocs++;
+			mm->stats.cache_hits++;
+			return 0;
 		}
 	}
-	if (last)
-		last->next = 0;
+	ret = mm->backend->alloc(mm, num, sizes, flags, psize, start, end, res);
+	if (ret == -ENOMEM && mm->ncached) {
+		if (pscnv_mm_debug >= 1)
+			NV_INFO(mm->dev, "MM: Allocation failed, coalescing %d cached nodes\n", mm->ncached);
+		pscnv_mm_coalesce(mm);
+		ret = mm->backend->alloc(mm, num, sizes, flags, psize, start, end, res);
+	}
+	write_seqcount_end(&mm->seq);
+	if (ret)
+		mm->stats.fails++;
+	else
+		mm->stats.allocs += num;
+	return ret;
+}
+
+int pscnv_mm_alloc(struct pscnv_mm *mm, uint64_t size, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
+	return pscnv_mm_alloc_batch(mm, 1, &size, flags, start, end, res);
+}
+
+/*
+ * Buddy backend, for regions that only ever hold untiled large page
+ * allocations. Free space is indexed by power-of-two blocks of large
+ * pages, one free list per order, so placing and freeing a range takes
+ * O(log n) list operations and no tree walk. Ranges that aren't
+ * a power of two take the smallest block that holds them, and the tail
+ * goes straight back to the lists. Everything is large page aligned
+ * already, so there is no LSR period rounding to do either.
+ *
+ * Block state lives in arrays indexed by large page number: free list
+ * links, and the order of the free block starting there, if any.
+ */
+
+#define PSCNV_MM_BUDDY_NONE 0xffffffff
+
+struct pscnv_mm_buddy {
+	uint64_t base;
+	int shift;
+	int maxorder;
+	uint32_t nblocks;
+	uint32_t head[PSCNV_MM_BUDDY_ORDERS];
+	int nfree[PSCNV_MM_BUDDY_ORDERS];
+	uint32_t *next;
+	uint32_t *prev;
+	int8_t *order;
+};
+
+static void pscnv_mm_buddy_push(struct pscnv_mm_buddy *b, uint32_t idx, int k) {
+	b->order[idx] = k;
+	b->prev[idx] = PSCNV_MM_BUDDY_NONE;
+	b->next[idx] = b->head[k];
+	if (b->head[k] != PSCNV_MM_BUDDY_NONE)
+		b->prev[b->head[k]] = idx;
+	b->head[k] = idx;
+	b->nfree[k]++;
+}
+
+static void pscnv_mm_buddy_unlink(struct pscnv_mm_buddy *b, uint32_t idx) {
+	int k = b->order[idx];
+	if (b->prev[idx] != PSCNV_MM_BUDDY_NONE)
+		b->next[b->prev[idx]] = b->next[idx];
+	else
+		b->head[k] = b->next[idx];
+	if (b->next[idx] != PSCNV_MM_BUDDY_NONE)
+		b->prev[b->next[idx]] = b->prev[idx];
+	b->order[idx] = -1;
+	b->nfree[k]--;
+}
+
+/* Frees one aligned block, merging it with its buddy as far as it goes. */
+static void pscnv_mm_buddy_free_block(struct pscnv_mm_buddy *b, uint32_t idx, int k) {
+	while (k < b->maxorder) {
+		uint32_t bud = idx ^ (1 << k);
+		if (bud >= b->nblocks || b->order[bud] != k)
+			break;
+		pscnv_mm_buddy_unlink(b, bud);
+		if (bud < idx)
+			idx = bud;
+		k++;
+	}
+	pscnv_mm_buddy_push(b, idx, k);
+}
+
+/* Frees an arbitrary run of blocks, as the largest aligned blocks it
+ * splits into. */
+static void pscnv_mm_buddy_free_range(struct pscnv_mm_buddy *b, uint32_t idx, uint32_t num) {
+	while (num) {
+		int k = 0;
+		while (k < b->maxorder && !(idx & ((2 << k) - 1)) && (2u << k) <= num)
+			k++;
+		pscnv_mm_buddy_free_block(b, idx, k);
+		idx += 1 << k;
+		num -= 1 << k;
+	}
+}
+
+/* Takes num blocks lying within sidx..eidx. For the whole region this
+ * is the head of the first non-empty list; a narrower window makes us
+ * look through the lists, and only at whole free blocks. */
+static int pscnv_mm_buddy_take(struct pscnv_mm_buddy *b, uint32_t num, uint32_t sidx, uint32_t eidx, uint32_t *res) {
+	uint32_t idx;
+	int k, j;
+	for (k = 0; k < b->maxorder && (1u << k) < num; k++);
+	if ((1u << k) < num)
+		return -ENOMEM;
+	for (j = k; j <= b->maxorder; j++) {
+		for (idx = b->head[j]; idx != PSCNV_MM_BUDDY_NONE; idx = b->next[idx])
+			if (idx >= sidx && idx + num <= eidx)
+				break;
+		if (idx == PSCNV_MM_BUDDY_NONE)
+			continue;
+		pscnv_mm_buddy_unlink(b, idx);
+		pscnv_mm_buddy_free_range(b, idx + num, (1 << j) - num);
+		*res = idx;
+		return 0;
+	}
+	return -ENOMEM;
+}
+
+static int pscnv_mm_buddy_alloc(struct pscnv_mm *mm, int num, const uint64_t *sizes, uint32_t flags, uint32_t psize, uint64_t start, uint64_t end, struct pscnv_mm_node **res) {
+	struct pscnv_mm_buddy *b = mm->backend_priv;
+	uint64_t bstart = b->base, bend = b->base + ((uint64_t)b->nblocks << b->shift);
+	uint32_t sidx, eidx, idx;
+	int i, ret;
+	/* tiled and small page allocations belong elsewhere */
+	if ((flags & PSCNV_MM_T1) || !(flags & PSCNV_MM_LP))
+		return -ENOMEM;
+	if (start > bstart)
+		bstart = start;
+	if (end < bend)
+		bend = end;
+	if (bend <= bstart)
+		return -ENOMEM;
+	sidx = (bstart - b->base) >> b->shift;
+	eidx = (bend - b->base) >> b->shift;
+	for (i = 0; i < num; i++) {
+		uint64_t size = pscnv_roundup(sizes[i], psize);
+		struct pscnv_mm_node *node;
+		uint64_t s;
+		if (pscnv_mm_debug >= 1)
+			NV_INFO(mm->dev, "MM: Buddy allocation size %llx at %llx..%llx flags %d\n", size, start, end, flags);
+		ret = pscnv_mm_fill_spare(mm, PSCNV_MM_SPARE_MIN);
+		if (!ret && (size >> b->shift) > PSCNV_MM_BUDDY_NONE)
+			ret = -ENOMEM;
+		if (!ret)
+			ret = pscnv_mm_buddy_take(b, size >> b->shift, sidx, eidx, &idx);
+		if (ret)
+			goto fail;
+		s = b->base + ((uint64_t)idx << b->shift);
+		/* buddy free space is always free in the tree too */
+		node = pscnv_mm_find_node(mm, s);
+		BUG_ON(!node || node->type != PSCNV_MM_TYPE_FREE || node->start + node->size < s + size);
+		res[i] = pscnv_mm_take(node, s, s + size, flags);
+		res[i]->next = res[i]->prev = 0;
+	}
 	return 0;
+
+fail:
+	while (i--) {
+		pscnv_mm_free_chain(res[i]);
+		res[i] = 0;
+	}
+	return ret;
+}
+
+static void pscnv_mm_buddy_release(struct pscnv_mm_node *node) {
+	struct pscnv_mm_buddy *b = node->mm->backend_priv;
+	pscnv_mm_buddy_free_range(b, (node->start - b->base) >> b->shift, node->size >> b->shift);
+}
+
+static void pscnv_mm_buddy_takedown(struct pscnv_mm *mm) {
+	struct pscnv_mm_buddy *b = mm->backend_priv;
+	vfree(b->next);
+	vfree(b->prev);
+	vfree(b->order);
+	kfree(b);
+}
+
+static const struct pscnv_mm_backend pscnv_mm_buddy_backend = {
+	.name = "buddy",
+	.alloc = pscnv_mm_buddy_alloc,
+	.release = pscnv_mm_buddy_release,
+	.takedown = pscnv_mm_buddy_takedown,
+};
+
+/* Like pscnv_mm_init, but with the buddy backend: only untiled large page
+ * allocations are accepted. lpsize has to be a power of two. */
+int pscnv_mm_init_buddy(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t spsize, uint32_t lpsize, uint32_t tssize, struct pscnv_mm **res) {
+	struct pscnv_mm_buddy *b;
+	uint64_t bstart = pscnv_roundup(start, lpsize), bend = pscnv_rounddown(end, lpsize);
+	struct pscnv_mm *mm;
+	int ret;
+	if (lpsize & (lpsize - 1) || bend <= bstart || (bend - bstart) / lpsize >= PSCNV_MM_BUDDY_NONE)
+		return -EINVAL;
+	b = kzalloc(sizeof *b, GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	b->base = bstart;
+	for (b->shift = 0; (1u << b->shift) < lpsize; b->shift++);
+	b->nblocks = (bend - bstart) >> b->shift;
+	for (b->maxorder = 0; b->maxorder < PSCNV_MM_BUDDY_ORDERS - 1 && (2u << b->maxorder) <= b->nblocks; b->maxorder++);
+	b->next = vmalloc(b->nblocks * sizeof *b->next);
+	b->prev = vmalloc(b->nblocks * sizeof *b->prev);
+	b->order = vmalloc(b->nblocks * sizeof *b->order);
+	if (!b->next || !b->prev || !b->order) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(b->head, 0xff, sizeof b->head);
+	memset(b->order, 0xff, b->nblocks * sizeof *b->order);
+	pscnv_mm_buddy_free_range(b, 0, b->nblocks);
+
+	ret = pscnv_mm_init(dev, start, end, spsize, lpsize, tssize, &mm);
+	if (ret)
+		goto fail;
+	mm->backend = &pscnv_mm_buddy_backend;
+	mm->backend_priv = b;
+	*res = mm;
+	return 0;
+
+fail:
+	vfree(b->next);
+	vfree(b->prev);
+	vfree(b->order);
+	kfree(b);
+	return ret;
+}
+
+/* In-order iteration over all nodes, free ones included, sentinels not. */
+struct pscnv_mm_node *pscnv_mm_first(struct pscnv_mm *mm) {
+	struct pscnv_mm_node *node = PSCNV_RB_MIN(pscnv_mm_head, &mm->head);
+	return pscnv_mm_next(node);
+}
+
+struct pscnv_mm_node *pscnv_mm_last(struct pscnv_mm *mm) {
+	struct pscnv_mm_node *node = PSCNV_RB_MAX(pscnv_mm_head, &mm->head);
+	return pscnv_mm_prev(node);
+}
+
+struct pscnv_mm_node *pscnv_mm_next(struct pscnv_mm_node *node) {
+	node = PSCNV_RB_NEXT(pscnv_mm_head, entry, node);
+	if (!node || node->sentinel)
+		return 0;
+	return node;
+}
+
+struct pscnv_mm_node *pscnv_mm_prev(struct pscnv_mm_node *node) {
+	node = PSCNV_RB_PREV(pscnv_mm_head, entry, node);
+	if (!node || node->sentinel)
+		return 0;
+	return node;
+}
+
+/* Largest free extent usable for an allocation with the given flags. */
+uint64_t pscnv_mm_largest(struct pscnv_mm *mm, uint32_t flags) {
+	return PSCNV_RB_ROOT(&mm->head)->maxgap[flags & TMASK];
+}
+
+/* Walks the whole tree, so it's meant for debugging and statistics. */
+void pscnv_mm_get_info(struct pscnv_mm *mm, struct pscnv_mm_info *info) {
+	struct pscnv_mm_node *node;
+	int i, b;
+	memset(info, 0, sizeof *info);
+	for (i = 0; i < GTYPES; i++)
+		info->largest[i] = pscnv_mm_largest(mm, i);
+	for (node = pscnv_mm_first(mm); node; node = pscnv_mm_next(node)) {
+		info->nodes++;
+		if (node->cached)
+			info->cachednodes++;
+		if (node->type != PSCNV_MM_TYPE_FREE)
+			continue;
+		info->freenodes++;
+		info->freebytes += node->size;
+		for (i = 0; i < GTYPES; i++) {
+			if (!node->gap[i])
+				continue;
+			for (b = 0; b < PSCNV_MM_HIST_BUCKETS - 1; b++)
+				if (node->gap[i] < (uint64_t)PSCNV_MM_HIST_BASE << (b + 1))
+					break;
+			info->hist[i][b]++;
+		}
+	}
+
+	if (mm->backend == &pscnv_mm_buddy_backend) {
+		struct pscnv_mm_buddy *bd = mm->backend_priv;
+		for (i = 0; i < PSCNV_MM_BUDDY_ORDERS; i++)
+			info->buddy[i] = bd->nfree[i];
+	}
 }
 
 struct pscnv_mm_node *pscnv_mm_find_node(struct pscnv_mm *mm, uint64_t addr) {
@@ -316,3 +898,51 @@ struct pscnv_mm_node *pscnv_mm_find_node(struct pscnv_mm *mm, uint64_t addr) {
 	}
 	return 0;
 }
+
+/* Like pscnv_mm_find_node, but without the lock protecting the mm: the
+ * walk runs under RCU and is validated against mm->seq, so it never
+ * waits for, nor holds up, allocations. Usable from interrupt context.
+ *
+ * On success, *res is a copy of the node containing addr, free and
+ * cached ones included. Only the copy is returned since the node itself
+ * may be gone by then; its tree and chain links must not be followed,
+ * and tag is only as good as the caller's knowledge of its lifetime.
+ * A node that was just allocated may not have its tag set yet.
+ *
+ * Returns -ENOENT if addr is outside the mm, or -EBUSY if the tree kept
+ * changing under us. Writers may be on this CPU, so we can't wait. */
+int pscnv_mm_lookup(struct pscnv_mm *mm, uint64_t addr, struct pscnv_mm_node *res) {
+	struct pscnv_mm_node *node;
+	unsigned seq;
+	int tries, steps, found;
+	for (tries = 0; tries < PSCNV_MM_LOOKUP_TRIES; tries++) {
+		seq = ACCESS_ONCE(mm->seq.sequence);
+		smp_rmb();
+		if (seq & 1) {
+			cpu_relax();
+			continue;
+		}
+		found = 0;
+		rcu_read_lock();
+		node = ACCESS_ONCE(PSCNV_RB_ROOT(&mm->head));
+		/* a torn walk can run in circles, cut it short */
+		for (steps = 0; node && steps < PSCNV_MM_LOOKUP_DEPTH; steps++) {
+			if (addr < node->start) {
+				node = ACCESS_ONCE(PSCNV_RB_LEFT(node, entry));
+			} else if (addr >= node->start + node->size) {
+				node = ACCESS_ONCE(PSCNV_RB_RIGHT(node, entry));
+			} else {
+				*res = *node;
+				found = 1;
+				break;
+			}
+		}
+		rcu_read_unlock();
+		if (read_seqcount_retry(&mm->seq, seq))
+			continue;
+		if (!found || res->sentinel)
+			return -ENOENT;
+		return 0;
+	}
+	return -EBUSY;
+}
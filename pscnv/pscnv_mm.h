@@ -4,15 +4,80 @@
 #include "drmP.h"
 #include "drm.h"
 #include "pscnv_tree.h"
+#include <linux/seqlock.h>
 
 PSCNV_RB_HEAD(pscnv_mm_head, pscnv_mm_node);
 
+struct pscnv_mm;
+struct pscnv_mm_node;
+
+/* Decides where allocations go. The tree always records the result, so
+ * lookups, iteration and statistics work the same for every backend. */
+struct pscnv_mm_backend {
+	const char *name;
+	/* places num ranges, all or nothing, with the same arguments as
+	 * pscnv_mm_alloc_batch after rounding start and end to psize */
+	int (*alloc) (struct pscnv_mm *mm, int num, const uint64_t *sizes, uint32_t flags, uint32_t psize, uint64_t start, uint64_t end, struct pscnv_mm_node **res);
+	/* optional, called on each used node as it goes back to the tree */
+	void (*release) (struct pscnv_mm_node *node);
+	/* optional, frees the backend's own state */
+	void (*takedown) (struct pscnv_mm *mm);
+};
+
+/* block orders of the buddy backend, in large pages */
+#define PSCNV_MM_BUDDY_ORDERS 20
+
+/* number of size classes with a free-list fast path */
+#define PSCNV_MM_CLASSES 3
+
+/* event counters, updated under the lock protecting the mm */
+struct pscnv_mm_stats {
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t fails;
+	uint64_t splits;
+	uint64_t merges;
+	uint64_t cache_hits;
+};
+
+/* free gap histogram buckets: bucket i counts gaps of at least
+ * PSCNV_MM_HIST_BASE << i bytes, and less than twice that */
+#define PSCNV_MM_HIST_BUCKETS 16
+#define PSCNV_MM_HIST_BASE 0x1000
+
+/* a snapshot of the mm layout, see pscnv_mm_get_info */
+struct pscnv_mm_info {
+	int nodes;
+	int freenodes;
+	int cachednodes;
+	uint64_t freebytes;
+	uint64_t largest[4];
+	int hist[4][PSCNV_MM_HIST_BUCKETS];
+	/* buddy backend only: free blocks per order */
+	int buddy[PSCNV_MM_BUDDY_ORDERS];
+};
+
 struct pscnv_mm {
 	struct drm_device *dev;
 	struct pscnv_mm_head head;
 	uint32_t spsize;
 	uint32_t lpsize;
 	uint32_t tssize;
+	const struct pscnv_mm_backend *backend;
+	void *backend_priv;
+	/* bumped around every tree change, for pscnv_mm_lookup */
+	seqcount_t seq;
+	/* PSCNV_MM_* flags added to every allocation, eg. PSCNV_MM_BESTFIT */
+	uint32_t policy;
+	/* preallocated nodes for splits, linked through ->next */
+	struct pscnv_mm_node *spare;
+	int nspare;
+	/* freed nodes of a class size, per gap type, linked through ->next.
+	 * they stay in the tree as used nodes until coalesced. */
+	struct pscnv_mm_node *cache[PSCNV_MM_CLASSES][4];
+	int ncache[PSCNV_MM_CLASSES][4];
+	int ncached;
+	struct pscnv_mm_stats stats;
 };
 
 struct pscnv_mm_node {
@@ -21,6 +86,8 @@ struct pscnv_mm_node {
 	uint64_t maxgap[4];
 	uint64_t gap[4];
 	int sentinel;
+	/* on one of the mm's class free lists */
+	int cached;
 	enum {
 		PSCNV_MM_TYPE_USED0,
 		PSCNV_MM_TYPE_USED1,
@@ -32,17 +99,37 @@ struct pscnv_mm_node {
 	struct pscnv_mm_node *prev;
 	void *tag;
 	void *tag2;
+	/* vspace maps only: the part of the BO in tag that is mapped */
+	uint64_t bo_offset;
+	uint64_t bo_length;
 };
 
 #define PSCNV_MM_T1		1
 #define PSCNV_MM_LP		2
 #define PSCNV_MM_FRAGOK		4
 #define PSCNV_MM_FROMBACK	8
+#define PSCNV_MM_BESTFIT	16
+
+/* pscnv_mm_lookup retries before giving up, and its maximum walk depth */
+#define PSCNV_MM_LOOKUP_TRIES	8
+#define PSCNV_MM_LOOKUP_DEPTH	128
 
+int pscnv_mm_cache_init(void);
+void pscnv_mm_cache_takedown(void);
 int pscnv_mm_init(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t spsize, uint32_t lpsize, uint32_t tssize, struct pscnv_mm **res);
+int pscnv_mm_init_buddy(struct drm_device *dev, uint64_t start, uint64_t end, uint32_t spsize, uint32_t lpsize, uint32_t tssize, struct pscnv_mm **res);
 int pscnv_mm_alloc(struct pscnv_mm *mm, uint64_t size, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res);
+int pscnv_mm_alloc_batch(struct pscnv_mm *mm, int num, const uint64_t *sizes, uint32_t flags, uint64_t start, uint64_t end, struct pscnv_mm_node **res);
 void pscnv_mm_free(struct pscnv_mm_node *node);
+void pscnv_mm_flush_cache(struct pscnv_mm *mm);
 void pscnv_mm_takedown(struct pscnv_mm *mm, void (*free_callback)(struct pscnv_mm_node *));
 struct pscnv_mm_node *pscnv_mm_find_node(struct pscnv_mm *mm, uint64_t addr);
+int pscnv_mm_lookup(struct pscnv_mm *mm, uint64_t addr, struct pscnv_mm_node *res);
+struct pscnv_mm_node *pscnv_mm_first(struct pscnv_mm *mm);
+struct pscnv_mm_node *pscnv_mm_last(struct pscnv_mm *mm);
+struct pscnv_mm_node *pscnv_mm_next(struct pscnv_mm_node *node);
+struct pscnv_mm_node *pscnv_mm_prev(struct pscnv_mm_node *node);
+uint64_t pscnv_mm_largest(struct pscnv_mm *mm, uint32_t flags);
+void pscnv_mm_get_info(struct pscnv_mm *mm, struct pscnv_mm_info *info);
 
 #endif
@@ -0,0 +1,314 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * dma-buf export and import of BOs, on kernels that have PRIME.
+ *
+ * Only sysram BOs can be exported, as their pages. VRAM BOs are refused
+ * with -EINVAL: the only address we could hand out for them is their
+ * BAR1 window's CPU physical address, which is not a DMA address a peer
+ * device can use without an IOMMU mapping or P2P support we don't have.
+ *
+ * Imported buffers become sysram BOs built straight from the exporter's
+ * DMA addresses, cut into the usual per-chunk tables. They have no
+ * pages of their own and can't be mmapped through us.
+ */
+
+#include "drmP.h"
+#include "drm.h"
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+#include "pscnv_vm.h"
+#include "pscnv_gem.h"
+#include "pscnv_kapi.h"
+
+#ifdef PSCNV_KAPI_DRM_GEM_PRIME
+
+#include <linux/dma-buf.h>
+#include <linux/highmem.h>
+
+static int
+pscnv_prime_is_vram(struct pscnv_bo *bo)
+{
+	return (bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_SMALL ||
+		(bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE;
+}
+
+static struct sg_table *
+pscnv_prime_map_dma_buf(struct dma_buf_attachment *attach, enum dma_data_direction dir)
+{
+	struct drm_gem_object *obj = attach->dmabuf->priv;
+	struct pscnv_bo *bo = obj->driver_private;
+	struct sg_table *sgt;
+	int ret;
+
+	/* never exported, see above */
+	if (pscnv_prime_is_vram(bo))
+		return ERR_PTR(-EINVAL);
+	sgt = kzalloc(sizeof *sgt, GFP_KERNEL);
+	if (!sgt)
+		return ERR_PTR(-ENOMEM);
+	ret = pscnv_sysram_build_sgt(bo, sgt, 0, bo->size >> PAGE_SHIFT);
+	if (ret)
+		goto fail;
+	sgt->nents = dma_map_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir);
+	if (!sgt->nents) {
+		sg_free_table(sgt);
+		ret = -ENOMEM;
+		goto fail;
+	}
+	return sgt;
+fail:
+	kfree(sgt);
+	return ERR_PTR(ret);
+}
+
+static void
+pscnv_prime_unmap_dma_buf(struct dma_buf_attachment *attach, struct sg_table *sgt,
+		enum dma_data_direction dir)
+{
+	dma_unmap_sg(attach->dev, sgt->sgl, sgt->orig_nents, dir);
+	sg_free_table(sgt);
+	kfree(sgt);
+}
+
+static void
+pscnv_prime_release(struct dma_buf *dma_buf)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+	if (obj->export_dma_buf == dma_buf) {
+		/* drop the reference the export created */
+		obj->export_dma_buf = NULL;
+		drm_gem_object_unreference_unlocked(obj);
+	}
+}
+
+static struct page *
+pscnv_prime_page(struct dma_buf *dma_buf, unsigned long page_num)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+	struct pscnv_bo *bo = obj->driver_private;
+	if (!bo->pages || page_num >= bo->size >> PAGE_SHIFT)
+		return NULL;
+	return bo->pages[page_num];
+}
+
+static void *
+pscnv_prime_kmap(struct dma_buf *dma_buf, unsigned long page_num)
+{
+	struct page *page = pscnv_prime_page(dma_buf, page_num);
+	return page ? kmap(page) : NULL;
+}
+
+static void
+pscnv_prime_kunmap(struct dma_buf *dma_buf, unsigned long page_num, void *addr)
+{
+	kunmap(pscnv_prime_page(dma_buf, page_num));
+}
+
+static void *
+pscnv_prime_kmap_atomic(struct dma_buf *dma_buf, unsigned long page_num)
+{
+	struct page *page = pscnv_prime_page(dma_buf, page_num);
+	return page ? kmap_atomic(page) : NULL;
+}
+
+static void
+pscnv_prime_kunmap_atomic(struct dma_buf *dma_buf, unsigned long page_num, void *addr)
+{
+	kunmap_atomic(addr);
+}
+
+static int
+pscnv_prime_mmap(struct dma_buf *dma_buf, struct vm_area_struct *vma)
+{
+	return -EINVAL;
+}
+
+static const struct dma_buf_ops pscnv_dmabuf_ops = {
+	.map_dma_buf = pscnv_prime_map_dma_buf,
+	.unmap_dma_buf = pscnv_prime_unmap_dma_buf,
+	.release = pscnv_prime_release,
+	.kmap = pscnv_prime_kmap,
+	.kunmap = pscnv_prime_kunmap,
+	.kmap_atomic = pscnv_prime_kmap_atomic,
+	.kunmap_atomic = pscnv_prime_kunmap_atomic,
+	.mmap = pscnv_prime_mmap,
+};
+
+/* Gets a BO ready to be seen by other devices: lazy sysram ones need all
+ * of their pages. */
+struct dma_buf *
+pscnv_gem_prime_export(struct drm_device *dev, struct drm_gem_object *obj, int flags)
+{
+	struct pscnv_bo *bo = obj->driver_private;
+	int c, ret;
+
+	if (bo->flags & PSCNV_GEM_PRIME)
+		return ERR_PTR(-EINVAL);
+	if (pscnv_prime_is_vram(bo))
+		return ERR_PTR(-EINVAL);
+	if (bo->flags & PSCNV_GEM_LAZY) {
+		for (c = 0; c < (bo->size + PSCNV_SYSRAM_CHUNK_SIZE - 1) >> PSCNV_SYSRAM_CHUNK_SHIFT; c++) {
+			ret = pscnv_sysram_populate(bo, c);
+			if (ret)
+				return ERR_PTR(ret);
+		}
+	}
+	return dma_buf_export(obj, &pscnv_dmabuf_ops, obj->size, flags);
+}
+
+/* Cuts the exporter's DMA segments at chunk boundaries, into the tables
+ * the VM code maps sysram BOs from. */
+static int
+pscnv_prime_split(struct pscnv_bo *bo, struct sg_table *sgt)
+{
+	int nchunks = (bo->size + PSCNV_SYSRAM_CHUNK_SIZE - 1) >> PSCNV_SYSRAM_CHUNK_SHIFT;
+	struct scatterlist **cur;
+	struct scatterlist *sg;
+	int *counts;
+	uint64_t off, addr, len, piece;
+	int pass, c, i, ret = -ENOMEM;
+
+	bo->chunks = kzalloc(nchunks * sizeof *bo->chunks, GFP_KERNEL);
+	counts = kzalloc(nchunks * sizeof *counts, GFP_KERNEL);
+	cur = kzalloc(nchunks * sizeof *cur, GFP_KERNEL);
+	if (!bo->chunks || !counts || !cur)
+		goto out;
+
+	/* the first pass counts the pieces of each chunk, the second one
+	 * fills them in */
+	for (pass = 0; pass < 2; pass++) {
+		off = 0;
+		for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+			addr = sg_dma_address(sg);
+			len = sg_dma_len(sg);
+			if ((addr | len) & ~PAGE_MASK) {
+				ret = -EINVAL;
+				goto out;
+			}
+			while (len && off < bo->size) {
+				c = off >> PSCNV_SYSRAM_CHUNK_SHIFT;
+				piece = min(len, ((uint64_t)(c + 1) << PSCNV_SYSRAM_CHUNK_SHIFT) - off);
+				if (pass) {
+					sg_dma_address(cur[c]) = addr;
+					sg_dma_len(cur[c]) = piece;
+					cur[c]->length = piece;
+					cur[c] = sg_next(cur[c]);
+				} else {
+					counts[c]++;
+				}
+				addr += piece;
+				len -= piece;
+				off += piece;
+			}
+		}
+		if (off < bo->size) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (pass)
+			break;
+		for (c = 0; c < nchunks; c++) {
+			if (sg_alloc_table(&bo->chunks[c], counts[c], GFP_KERNEL))
+				goto out;
+			cur[c] = bo->chunks[c].sgl;
+		}
+	}
+	ret = 0;
+out:
+	if (ret && bo->chunks) {
+		for (c = 0; c < nchunks; c++)
+			if (bo->chunks[c].sgl)
+				sg_free_table(&bo->chunks[c]);
+		kfree(bo->chunks);
+		bo->chunks = 0;
+	}
+	kfree(counts);
+	kfree(cur);
+	return ret;
+}
+
+struct drm_gem_object *
+pscnv_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
+{
+	struct dma_buf_attachment *attach;
+	struct drm_gem_object *obj;
+	struct pscnv_bo *bo;
+	struct sg_table *sgt;
+	int ret;
+
+	if (dma_buf->ops == &pscnv_dmabuf_ops) {
+		obj = dma_buf->priv;
+		if (obj->dev == dev) {
+			drm_gem_object_reference(obj);
+			return obj;
+		}
+	}
+	if (!dma_buf->size || dma_buf->size & ~PAGE_MASK)
+		return ERR_PTR(-EINVAL);
+
+	attach = dma_buf_attach(dma_buf, dev->dev);
+	if (IS_ERR(attach))
+		return ERR_CAST(attach);
+	sgt = dma_buf_map_attachment(attach, DMA_BIDIRECTIONAL);
+	if (IS_ERR(sgt)) {
+		ret = PTR_ERR(sgt);
+		goto fail_detach;
+	}
+
+	bo = pscnv_mem_alloc_empty(dev, dma_buf->size, PSCNV_GEM_SYSRAM_SNOOP | PSCNV_GEM_PRIME, 0);
+	if (!bo) {
+		ret = -ENOMEM;
+		goto fail_unmap;
+	}
+	mutex_init(&bo->sysram_lock);
+	ret = pscnv_prime_split(bo, sgt);
+	if (ret) {
+		kfree(bo);
+		goto fail_unmap;
+	}
+	bo->import_sgt = sgt;
+	if (pscnv_mem_debug >= 1)
+		NV_INFO(dev, "Imported %d, %#llx-byte dma-buf BO\n", bo->serial, bo->size);
+
+	obj = pscnv_gem_wrap(dev, bo, 0);
+	if (!obj) {
+		/* the BO is gone, with its tables */
+		ret = -ENOMEM;
+		goto fail_unmap;
+	}
+	obj->import_attach = attach;
+	return obj;
+
+fail_unmap:
+	dma_buf_unmap_attachment(attach, sgt, DMA_BIDIRECTIONAL);
+fail_detach:
+	dma_buf_detach(dma_buf, attach);
+	return ERR_PTR(ret);
+}
+
+#endif
@@ -2,51 +2,262 @@
 #include "drm.h"
 #include "nouveau_drv.h"
 #include "pscnv_mem.h"
+#include "pscnv_vm.h"
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
 #include <linux/gfp.h>
+#include <linux/scatterlist.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
 
+/* The page all unpopulated parts of lazy BOs are GPU-mapped to. The GPU
+ * can write to it, so it's only zero until it isn't. */
 int
-pscnv_sysram_alloc(struct pscnv_bo *bo)
+pscnv_sysram_init(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	dev_priv->dummy_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!dev_priv->dummy_page)
+		return -ENOMEM;
+	dev_priv->dummy_dma = pci_map_page(dev->pdev, dev_priv->dummy_page, 0, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
+	if (pci_dma_mapping_error(dev->pdev, dev_priv->dummy_dma)) {
+		__free_page(dev_priv->dummy_page);
+		dev_priv->dummy_page = 0;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void
+pscnv_sysram_takedown(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	if (!dev_priv->dummy_page)
+		return;
+	pci_unmap_page(dev->pdev, dev_priv->dummy_dma, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
+	__free_page(dev_priv->dummy_page);
+	dev_priv->dummy_page = 0;
+}
+
+static int
+pscnv_sysram_nchunks(struct pscnv_bo *bo)
 {
-	int numpages, i, j;
+	return (bo->size + PSCNV_SYSRAM_CHUNK_SIZE - 1) >> PSCNV_SYSRAM_CHUNK_SHIFT;
+}
+
+/* Fills bo->pages[first..end) from the highest page orders available.
+ * Once an order fails, we're under pressure and only try smaller ones
+ * from then on. Blocks are split, so that their pages can be faulted in
+ * and freed one by one like order-0 ones. */
+static int
+pscnv_sysram_alloc_pages(struct pscnv_bo *bo, int first, int end)
+{
+	int order = PSCNV_SYSRAM_MAX_ORDER;
+	int i = first, j;
+	struct page *p;
 	gfp_t gfp_flags;
+	if (bo->dev->pdev->dma_mask > 0xffffffff)
+		gfp_flags = GFP_KERNEL;
+	else
+		gfp_flags = GFP_DMA32;
+	/* lazy chunks replace the read-only, zeroed dummy page, and should
+	 * read the same */
+	if (bo->flags & PSCNV_GEM_LAZY)
+		gfp_flags |= __GFP_ZERO;
+	while (i < end) {
+		while ((1 << order) > end - i)
+			order--;
+		if (order)
+			p = alloc_pages(gfp_flags | __GFP_NOWARN | __GFP_NORETRY, order);
+		else
+			p = alloc_pages(gfp_flags, 0);
+		if (!p) {
+			if (order) {
+				order--;
+				continue;
+			}
+			while (i-- > first) {
+				put_page(bo->pages[i]);
+				bo->pages[i] = 0;
+			}
+			return -ENOMEM;
+		}
+		split_page(p, order);
+		for (j = 0; j < (1 << order); j++)
+			bo->pages[i++] = p + j;
+	}
+	return 0;
+}
+
+/* Length in pages of the physically contiguous run starting at pages[i]. */
+static int
+pscnv_sysram_run(struct pscnv_bo *bo, int i, int end)
+{
+	int len = 1;
+	while (i + len < end &&
+			page_to_pfn(bo->pages[i + len]) == page_to_pfn(bo->pages[i]) + len)
+		len++;
+	return len;
+}
+
+/* Builds an sg table over pages [first, end), one entry per contiguous
+ * run. Not DMA-mapped yet. */
+int
+pscnv_sysram_build_sgt(struct pscnv_bo *bo, struct sg_table *sgt, int first, int end)
+{
+	struct scatterlist *sg;
+	int i, len, nents = 0, ret;
+	for (i = first; i < end; i += pscnv_sysram_run(bo, i, end))
+		nents++;
+	ret = sg_alloc_table(sgt, nents, GFP_KERNEL);
+	if (ret)
+		return ret;
+	for (i = first, sg = sgt->sgl; i < end; i += len, sg = sg_next(sg)) {
+		len = pscnv_sysram_run(bo, i, end);
+		sg_set_page(sg, bo->pages[i], len << PAGE_SHIFT, 0);
+	}
+	return 0;
+}
+
+/* Builds the sg table of a chunk and maps it. The IOMMU, if any, may
+ * merge entries further: only the first nents are valid for DMA. */
+static int
+pscnv_sysram_map(struct pscnv_bo *bo, int c, int first, int end)
+{
+	struct sg_table *sgt = &bo->chunks[c];
+	int ret;
+	ret = pscnv_sysram_build_sgt(bo, sgt, first, end);
+	if (ret)
+		return ret;
+	sgt->nents = pci_map_sg(bo->dev->pdev, sgt->sgl, sgt->orig_nents, PCI_DMA_BIDIRECTIONAL);
+	if (!sgt->nents) {
+		sg_free_table(sgt);
+		memset(sgt, 0, sizeof *sgt);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* Allocates and maps the pages of chunk c. Called with sysram_lock held,
+ * or before anyone else can see the BO. */
+static int
+pscnv_sysram_populate_locked(struct pscnv_bo *bo, int c)
+{
+	int first = c << (PSCNV_SYSRAM_CHUNK_SHIFT - PAGE_SHIFT);
+	int end = min_t(int, first + (1 << (PSCNV_SYSRAM_CHUNK_SHIFT - PAGE_SHIFT)), bo->size >> PAGE_SHIFT);
+	int ret, i;
+	ret = pscnv_sysram_alloc_pages(bo, first, end);
+	if (ret)
+		return ret;
+	ret = pscnv_sysram_map(bo, c, first, end);
+	if (ret) {
+		for (i = first; i < end; i++) {
+			put_page(bo->pages[i]);
+			bo->pages[i] = 0;
+		}
+	}
+	return ret;
+}
+
+/* Makes sure chunk c of a lazy BO is there, and points the BO's GPU
+ * mappings at it if we had to populate it. */
+int
+pscnv_sysram_populate(struct pscnv_bo *bo, int c)
+{
+	int ret = 0, new = 0;
+	mutex_lock(&bo->sysram_lock);
+	if (!bo->chunks[c].sgl) {
+		ret = pscnv_sysram_populate_locked(bo, c);
+		new = !ret;
+	}
+	mutex_unlock(&bo->sysram_lock);
+	if (new && atomic_read(&bo->vm_maps))
+		pscnv_vspace_remap_chunk(bo, c);
+	return ret;
+}
+
+int
+pscnv_sysram_alloc(struct pscnv_bo *bo)
+{
+	int numpages, nchunks, c, ret;
 	numpages = bo->size >> PAGE_SHIFT;
+	nchunks = pscnv_sysram_nchunks(bo);
 	if (numpages > 1 && bo->flags & PSCNV_GEM_CONTIG)
 		return -EINVAL;
-	bo->pages = kmalloc(numpages * sizeof *bo->pages, GFP_KERNEL);
+	bo->pages = kzalloc(numpages * sizeof *bo->pages, GFP_KERNEL);
 	if (!bo->pages)
 		return -ENOMEM;
-	bo->dmapages = kmalloc(numpages * sizeof *bo->dmapages, GFP_KERNEL);
-	if (!bo->dmapages) {
+	bo->chunks = kzalloc(nchunks * sizeof *bo->chunks, GFP_KERNEL);
+	if (!bo->chunks) {
 		kfree(bo->pages);
 		return -ENOMEM;
 	}
-	if (bo->dev->pdev->dma_mask > 0xffffffff)
-		gfp_flags = GFP_KERNEL;
-	else
-		gfp_flags = GFP_DMA32;
-	for (i = 0; i < numpages; i++) {
-		bo->pages[i] = alloc_pages(gfp_flags, 0);
-		if (!bo->pages[i]) {
-			for (j = 0; j < i; j++)
-				put_page(bo->pages[j]);
-			kfree(bo->pages);
-			kfree(bo->dmapages);
-			return -ENOMEM;
+	mutex_init(&bo->sysram_lock);
+	if (bo->flags & PSCNV_GEM_LAZY)
+		return 0;
+	for (c = 0; c < nchunks; c++) {
+		ret = pscnv_sysram_populate_locked(bo, c);
+		if (ret) {
+			pscnv_sysram_free(bo);
+			return ret;
 		}
 	}
-	for (i = 0; i < numpages; i++) {
-		bo->dmapages[i] = pci_map_page(bo->dev->pdev, bo->pages[i], 0, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-		if (pci_dma_mapping_error(bo->dev->pdev, bo->dmapages[i])) {
-			for (j = 0; j < i; j++)
-				pci_unmap_page(bo->dev->pdev, bo->dmapages[j], PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-			for (j = 0; j < numpages; j++)
-				put_page(bo->pages[j]);
-			kfree(bo->pages);
-			kfree(bo->dmapages);
-			return -ENOMEM;
+	return 0;
+}
+
+/* Pins the pages of a user range and maps them chunk by chunk, for a
+ * userptr BO. The pages are charged to the mm's locked_vm until the BO
+ * is freed. */
+int
+pscnv_sysram_userptr(struct pscnv_bo *bo, uint64_t addr)
+{
+	struct mm_struct *mm = current->mm;
+	int write = !(bo->flags & PSCNV_GEM_READONLY);
+	unsigned long locked;
+	int numpages, nchunks, cpages, c, i, ret;
+	numpages = bo->size >> PAGE_SHIFT;
+	nchunks = pscnv_sysram_nchunks(bo);
+	cpages = 1 << (PSCNV_SYSRAM_CHUNK_SHIFT - PAGE_SHIFT);
+	bo->pages = kzalloc(numpages * sizeof *bo->pages, GFP_KERNEL);
+	if (!bo->pages)
+		return -ENOMEM;
+	bo->chunks = kzalloc(nchunks * sizeof *bo->chunks, GFP_KERNEL);
+	if (!bo->chunks) {
+		kfree(bo->pages);
+		return -ENOMEM;
+	}
+	mutex_init(&bo->sysram_lock);
+
+	down_write(&mm->mmap_sem);
+	locked = mm->locked_vm + numpages;
+	if (locked > rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT && !capable(CAP_IPC_LOCK)) {
+		up_write(&mm->mmap_sem);
+		kfree(bo->chunks);
+		kfree(bo->pages);
+		return -ENOMEM;
+	}
+	ret = get_user_pages(current, mm, addr, numpages, write, 0, bo->pages, NULL);
+	if (ret < numpages) {
+		up_write(&mm->mmap_sem);
+		for (i = 0; i < ret; i++)
+			put_page(bo->pages[i]);
+		kfree(bo->chunks);
+		kfree(bo->pages);
+		return ret < 0 ? ret : -EFAULT;
+	}
+	mm->locked_vm = locked;
+	up_write(&mm->mmap_sem);
+	/* the BO may outlive the process: keep the mm around to uncharge */
+	atomic_inc(&mm->mm_count);
+	bo->userptr_mm = mm;
+
+	for (c = 0; c < nchunks; c++) {
+		ret = pscnv_sysram_map(bo, c, c * cpages, min(numpages, (c + 1) * cpages));
+		if (ret) {
+			pscnv_sysram_free(bo);
+			return ret;
 		}
 	}
 	return 0;
@@ -55,14 +266,55 @@ pscnv_sysram_alloc(struct pscnv_bo *bo)
 int
 pscnv_sysram_free(struct pscnv_bo *bo)
 {
-	int numpages, i;
+	int numpages, nchunks, i;
 	numpages = bo->size >> PAGE_SHIFT;
-	for (i = 0; i < numpages; i++)
-		pci_unmap_page(bo->dev->pdev, bo->dmapages[i], PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-	for (i = 0; i < numpages; i++)
+	nchunks = pscnv_sysram_nchunks(bo);
+	if (bo->flags & PSCNV_GEM_PRIME) {
+		/* the tables only hold the exporter's DMA addresses */
+		for (i = 0; i < nchunks; i++)
+			sg_free_table(&bo->chunks[i]);
+		kfree(bo->chunks);
+		return 0;
+	}
+	for (i = 0; i < nchunks; i++) {
+		if (!bo->chunks[i].sgl)
+			continue;
+		pci_unmap_sg(bo->dev->pdev, bo->chunks[i].sgl, bo->chunks[i].orig_nents, PCI_DMA_BIDIRECTIONAL);
+		sg_free_table(&bo->chunks[i]);
+	}
+	for (i = 0; i < numpages; i++) {
+		if (!bo->pages[i])
+			continue;
+		/* the card may have written to them behind the CPU's back */
+		if ((bo->flags & PSCNV_GEM_USERPTR) && !(bo->flags & PSCNV_GEM_READONLY))
+			set_page_dirty_lock(bo->pages[i]);
 		put_page(bo->pages[i]);
+	}
+	if (bo->userptr_mm) {
+		down_write(&bo->userptr_mm->mmap_sem);
+		bo->userptr_mm->locked_vm -= numpages;
+		up_write(&bo->userptr_mm->mmap_sem);
+		mmdrop(bo->userptr_mm);
+		bo->userptr_mm = 0;
+	}
+	kfree(bo->chunks);
 	kfree(bo->pages);
-	kfree(bo->dmapages);
+	return 0;
+}
+
+/* Inserts the pages [first, end) of a BO into a vma mapping it from its
+ * start. Pages already mapped are skipped. Stops at the first page that
+ * can't be inserted and returns its error. The caller makes sure they
+ * are populated. */
+static int
+pscnv_sysram_insert_pages(struct vm_area_struct *vma, struct pscnv_bo *bo, int first, int end)
+{
+	int i, ret;
+	for (i = first; i < end; i++) {
+		ret = vm_insert_page(vma, vma->vm_start + ((unsigned long)i << PAGE_SHIFT), bo->pages[i]);
+		if (ret && ret != -EBUSY)
+			return ret;
+	}
 	return 0;
 }
 
@@ -71,11 +323,46 @@ extern int pscnv_sysram_vm_fault(struct vm_area_struct *vma, struct vm_fault *vm
 	struct drm_gem_object *obj = vma->vm_private_data;
 	struct pscnv_bo *bo = obj->driver_private;
 	uint64_t offset = (uint64_t)vmf->virtual_address - vma->vm_start;
+	int idx = offset >> PAGE_SHIFT;
+	int window = min(pscnv_sysram_fault_around, 1 << PSCNV_SYSRAM_MAX_ORDER);
+	int first, end;
 	struct page *res;
-	if (offset > bo->size)
+	if (offset >= bo->size)
 		return VM_FAULT_SIGBUS;
-	res = bo->pages[offset >> PAGE_SHIFT];
+	if (bo->flags & PSCNV_GEM_LAZY &&
+			pscnv_sysram_populate(bo, offset >> PSCNV_SYSRAM_CHUNK_SHIFT))
+		return VM_FAULT_OOM;
+	res = bo->pages[idx];
 	get_page(res);
 	vmf->page = res;
+	/* Map the aligned window around the faulting page too. Being a power
+	 * of two no bigger than a chunk, it never leaves the chunk we just
+	 * made sure of. It's only an optimization: if an insert fails, the
+	 * rest of the window is left to later faults. */
+	if (window > 1) {
+		window = rounddown_pow_of_two(window);
+		first = idx & ~(window - 1);
+		end = min(first + window, (int)(bo->size >> PAGE_SHIFT));
+		end = min(end, (int)((vma->vm_end - vma->vm_start) >> PAGE_SHIFT));
+		if (!pscnv_sysram_insert_pages(vma, bo, first, idx))
+			pscnv_sysram_insert_pages(vma, bo, idx + 1, end);
+	}
 	return 0;
 }
+
+/* Maps everything present up front, for the sysram_prefault option.
+ * Unpopulated chunks of lazy BOs, and everything after a failed insert,
+ * are left to the fault path. */
+void
+pscnv_sysram_prefault_vma(struct vm_area_struct *vma, struct pscnv_bo *bo)
+{
+	int npages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	int cpages = 1 << (PSCNV_SYSRAM_CHUNK_SHIFT - PAGE_SHIFT);
+	int c;
+	mutex_lock(&bo->sysram_lock);
+	for (c = 0; c * cpages < npages; c++)
+		if (bo->chunks[c].sgl &&
+				pscnv_sysram_insert_pages(vma, bo, c * cpages, min(npages, (c + 1) * cpages)))
+			break;
+	mutex_unlock(&bo->sysram_lock);
+}
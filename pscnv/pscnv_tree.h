@@ -2,6 +2,7 @@
  * Originally sys/tree.h from FreeBSD. Changes:
  *  - SPLAY removed
  *  - name changed to avoid collisions
+ *  - RB_REMOVE propagates RB_AUGMENT all the way up to the root
  */
 
 /*
@@ -269,14 +270,13 @@ name##_PSCNV_RB_REMOVE_COLOR(struct name *head, struct type *parent, struct type
 attr struct type *							\
 name##_PSCNV_RB_REMOVE(struct name *head, struct type *elm)			\
 {									\
-	struct type *child, *parent, *old = elm;			\
+	struct type *child, *parent, *left, *old = elm;			\
 	int color;							\
 	if (PSCNV_RB_LEFT(elm, field) == NULL)				\
 		child = PSCNV_RB_RIGHT(elm, field);				\
 	else if (PSCNV_RB_RIGHT(elm, field) == NULL)				\
 		child = PSCNV_RB_LEFT(elm, field);				\
 	else {								\
-		struct type *left;					\
 		elm = PSCNV_RB_RIGHT(elm, field);				\
 		while ((left = PSCNV_RB_LEFT(elm, field)) != NULL)		\
 			elm = left;					\
@@ -324,7 +324,10 @@ name##_PSCNV_RB_REMOVE(struct name *head, struct type *elm)			\
 			PSCNV_RB_LEFT(parent, field) = child;			\
 		else							\
 			PSCNV_RB_RIGHT(parent, field) = child;		\
-		PSCNV_RB_AUGMENT(parent);					\
+		left = parent;						\
+		do {							\
+			PSCNV_RB_AUGMENT(left);				\
+		} while ((left = PSCNV_RB_PARENT(left, field)) != NULL);	\
 	} else								\
 		PSCNV_RB_ROOT(head) = child;					\
 color:									\
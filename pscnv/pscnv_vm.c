@@ -30,6 +30,7 @@
 #include "pscnv_mem.h"
 #include "pscnv_vm.h"
 #include "pscnv_chan.h"
+#include <linux/sort.h>
 
 
 static int pscnv_vspace_bind (struct pscnv_vspace *vs, int fake) {
@@ -86,6 +87,7 @@ pscnv_vspace_new (struct drm_device *dev, uint64_t size, uint32_t flags, int fak
 	res->flags = flags;
 	kref_init(&res->ref);
 	mutex_init(&res->lock);
+	INIT_LIST_HEAD(&res->resvs);
 	if (pscnv_vspace_bind(res, fake)) {
 		kfree(res);
 		return 0;
@@ -102,6 +104,16 @@ pscnv_vspace_new (struct drm_device *dev, uint64_t size, uint32_t flags, int fak
 static void
 pscnv_vspace_free_unmap(struct pscnv_mm_node *node) {
 	struct pscnv_bo *bo = node->tag;
+	struct pscnv_vspace_resv *resv;
+	if (!bo) {
+		/* a reservation, with the maps inside it */
+		resv = node->tag2;
+		pscnv_mm_takedown(resv->mm, pscnv_vspace_free_unmap);
+		kfree(resv);
+		pscnv_mm_free(node);
+		return;
+	}
+	atomic_dec(&bo->vm_maps);
 	drm_gem_object_unreference_unlocked(bo->gem);
 	pscnv_mm_free(node);
 }
@@ -119,6 +131,80 @@ void pscnv_vspace_ref_free(struct kref *ref) {
 	kfree(vs);
 }
 
+/* The reservation holding start..end whole, or 0. */
+static struct pscnv_vspace_resv *
+pscnv_vspace_find_resv(struct pscnv_vspace *vs, uint64_t start, uint64_t end) {
+	struct pscnv_vspace_resv *resv;
+	list_for_each_entry(resv, &vs->resvs, head)
+		if (resv->start <= start && end <= resv->end)
+			return resv;
+	return 0;
+}
+
+/* The map at start, inside a reservation or not, or 0. */
+static struct pscnv_mm_node *
+pscnv_vspace_find_map(struct pscnv_vspace *vs, uint64_t start) {
+	struct pscnv_mm_node *node = pscnv_mm_find_node(vs->mm, start);
+	struct pscnv_vspace_resv *resv;
+	if (node && node->type != PSCNV_MM_TYPE_FREE && !node->cached && !node->tag) {
+		resv = node->tag2;
+		node = pscnv_mm_find_node(resv->mm, start);
+	}
+	/* free space, or a freed node waiting on the mm free lists */
+	if (!node || node->type == PSCNV_MM_TYPE_FREE || node->cached)
+		return 0;
+	return node;
+}
+
+/* Allocates the VA of a map and tags it: from the reservation holding
+ * start..end, if there is one, or from the whole vspace. */
+static int
+pscnv_vspace_place(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		uint64_t bo_offset, uint64_t length,
+		uint64_t start, uint64_t end, int back,
+		struct pscnv_mm_node **res)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vspace_resv *resv = pscnv_vspace_find_resv(vs, start, end);
+	int ret;
+	if (!length || ((bo_offset | length) & (PSCNV_MEM_PAGE_SIZE - 1)) ||
+			bo_offset + length < bo_offset || bo_offset + length > bo->size)
+		return -EINVAL;
+	ret = dev_priv->vm->place_map(vs, resv ? resv->mm : vs->mm, bo, bo_offset, length, start, end, back, res);
+	if (ret)
+		return ret;
+	(*res)->tag = bo;
+	(*res)->tag2 = vs;
+	(*res)->bo_offset = bo_offset;
+	(*res)->bo_length = length;
+	/* small dummy PTEs would hide large pages mapped over them */
+	if (resv && (resv->flags & PSCNV_VSPACE_RESV_DUMMY))
+		dev_priv->vm->clear_ptes(vs, (*res)->start, (*res)->size);
+	return 0;
+}
+
+/* Clears the PTEs of a map, or points them back at the dummy page if
+ * its reservation asked for it. Doesn't flush. */
+static void
+pscnv_vspace_clear_map(struct pscnv_vspace *vs, struct pscnv_mm_node *node) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vspace_resv *resv = pscnv_vspace_find_resv(vs, node->start, node->start + node->size);
+	dev_priv->vm->clear_ptes(vs, node->start, node->size);
+	if (resv && (resv->flags & PSCNV_VSPACE_RESV_DUMMY))
+		dev_priv->vm->dummy_ptes(vs, node->start, node->size);
+}
+
+/* Drops the GEM reference held by a map of a user vspace. Only without
+ * vs->lock: the last reference frees the BO, which needs struct_mutex,
+ * and compaction relies on BOs only being freed under it. */
+static void
+pscnv_vspace_put_bo(struct pscnv_vspace *vs, struct pscnv_bo *bo) {
+	if (vs->vid >= 0)
+		drm_gem_object_unreference_unlocked(bo->gem);
+}
+
+/* Unmaps a node, with vs->lock held. The caller drops the BO's GEM
+ * reference with pscnv_vspace_put_bo after unlocking. */
 static int
 pscnv_vspace_unmap_node_unlocked(struct pscnv_mm_node *node) {
 	struct pscnv_vspace *vs = node->tag2;
@@ -127,11 +213,9 @@ pscnv_vspace_unmap_node_unlocked(struct pscnv_mm_node *node) {
 	if (pscnv_vm_debug >= 1) {
 		NV_INFO(vs->dev, "VM: vspace %d: Unmapping range %llx-%llx.\n", vs->vid, node->start, node->start + node->size);
 	}
-	dev_priv->vm->do_unmap(vs, node->start, node->size);
-
-	if (vs->vid >= 0) {
-		drm_gem_object_unreference(bo->gem);
-	}
+	pscnv_vspace_clear_map(vs, node);
+	dev_priv->vm->flush(vs);
+	atomic_dec(&bo->vm_maps);
 	pscnv_mm_free(node);
 	return 0;
 }
@@ -140,49 +224,356 @@ int
 pscnv_vspace_map(struct pscnv_vspace *vs, struct pscnv_bo *bo,
 		uint64_t start, uint64_t end, int back,
 		struct pscnv_mm_node **res)
+{
+	return pscnv_vspace_map_range(vs, bo, 0, bo->size, start, end, back, res);
+}
+
+/* Maps length bytes of a BO, from bo_offset on. Both have to be page
+ * aligned, and on nvc0 large page aligned for VRAM_LARGE BOs, but for a
+ * slice that runs to the end of the BO. */
+int
+pscnv_vspace_map_range(struct pscnv_vspace *vs, struct pscnv_bo *bo,
+		uint64_t bo_offset, uint64_t length,
+		uint64_t start, uint64_t end, int back,
+		struct pscnv_mm_node **res)
 {
 	struct pscnv_mm_node *node;
 	int ret;
 	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	/* mapping counts as use: bring it back to VRAM if it was evicted */
+	if (bo->evicted)
+		pscnv_vram_restore(bo);
+	pscnv_vram_lru_touch(bo);
 	mutex_lock(&vs->lock);
-	ret = dev_priv->vm->place_map(vs, bo, start, end, back, &node);
+	ret = pscnv_vspace_place(vs, bo, bo_offset, length, start, end, back, &node);
 	if (ret) {
 		mutex_unlock(&vs->lock);
 		return ret;
 	}
-	node->tag = bo;
-	node->tag2 = vs;
+	atomic_inc(&bo->vm_maps);
 	if (pscnv_vm_debug >= 1)
-		NV_INFO(vs->dev, "VM: vspace %d: Mapping BO %x/%d at %llx-%llx.\n", vs->vid, bo->cookie, bo->serial, node->start,
-				node->start + node->size);
-	ret = dev_priv->vm->do_map(vs, bo, node->start);
+		NV_INFO(vs->dev, "VM: vspace %d: Mapping BO %x/%d+%llx at %llx-%llx.\n", vs->vid, bo->cookie, bo->serial, bo_offset,
+				node->start, node->start + node->size);
+	ret = dev_priv->vm->do_map(vs, bo, node->start, bo_offset, length);
 	if (ret) {
 		pscnv_vspace_unmap_node_unlocked(node);
 	}
 	*res = node;
 	mutex_unlock(&vs->lock);
+	if (ret)
+		pscnv_vspace_put_bo(vs, bo);
 	return ret;
 }
 
 int
 pscnv_vspace_unmap_node(struct pscnv_mm_node *node) {
 	struct pscnv_vspace *vs = node->tag2;
+	struct pscnv_bo *bo = node->tag;
 	int ret;
 	mutex_lock(&vs->lock);
 	ret = pscnv_vspace_unmap_node_unlocked(node);
 	mutex_unlock(&vs->lock);
+	pscnv_vspace_put_bo(vs, bo);
 	return ret;
 }
 
+static int
+pscnv_vspace_node_cmp(const void *a, const void *b) {
+	const struct pscnv_mm_node *na = *(struct pscnv_mm_node * const *)a;
+	const struct pscnv_mm_node *nb = *(struct pscnv_mm_node * const *)b;
+	if (na->tag2 != nb->tag2)
+		return na->tag2 < nb->tag2 ? -1 : 1;
+	return 0;
+}
+
+/* Unmaps and frees many kernel mapping nodes at once, with a single
+ * flush per vspace involved. Reorders the array. Only for BAR vspaces:
+ * no GEM references are dropped. */
+void
+pscnv_vspace_unmap_nodes(struct pscnv_mm_node **nodes, int num) {
+	struct drm_nouveau_private *dev_priv;
+	struct pscnv_vspace *vs;
+	struct pscnv_bo *bo;
+	int i, j, end;
+	sort(nodes, num, sizeof *nodes, pscnv_vspace_node_cmp, NULL);
+	for (i = 0; i < num; i = end) {
+		vs = nodes[i]->tag2;
+		dev_priv = vs->dev->dev_private;
+		for (end = i; end < num && nodes[end]->tag2 == vs; end++);
+		mutex_lock(&vs->lock);
+		for (j = i; j < end; j++) {
+			bo = nodes[j]->tag;
+			if (pscnv_vm_debug >= 1)
+				NV_INFO(vs->dev, "VM: vspace %d: Unmapping range %llx-%llx.\n", vs->vid, nodes[j]->start,
+						nodes[j]->start + nodes[j]->size);
+			dev_priv->vm->clear_ptes(vs, nodes[j]->start, nodes[j]->size);
+			atomic_dec(&bo->vm_maps);
+		}
+		dev_priv->vm->flush(vs);
+		for (j = i; j < end; j++)
+			pscnv_mm_free(nodes[j]);
+		mutex_unlock(&vs->lock);
+	}
+}
+
 int
 pscnv_vspace_unmap(struct pscnv_vspace *vs, uint64_t start) {
+	struct pscnv_mm_node *node;
+	struct pscnv_bo *bo;
 	int ret;
 	mutex_lock(&vs->lock);
-	ret = pscnv_vspace_unmap_node_unlocked(pscnv_mm_find_node(vs->mm, start));
+	node = pscnv_vspace_find_map(vs, start);
+	if (!node) {
+		mutex_unlock(&vs->lock);
+		return -ENOENT;
+	}
+	bo = node->tag;
+	ret = pscnv_vspace_unmap_node_unlocked(node);
+	mutex_unlock(&vs->lock);
+	pscnv_vspace_put_bo(vs, bo);
+	return ret;
+}
+
+/* Applies map and unmap operations to a user vspace in order, under a
+ * single hold of its lock and with one flush at the end. Stops at the
+ * first failure and returns its error, with the number of operations
+ * applied in *done. A map that fails leaves its GEM reference to the
+ * caller. Unmapped BOs are only let go after the flush, so that their
+ * memory can't be reused while the TLBs may still point at it, and
+ * after unlocking, see pscnv_vspace_put_bo. */
+int
+pscnv_vspace_bind(struct pscnv_vspace *vs, struct pscnv_vspace_op *ops, int num, int *done) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_mm_node *node;
+	int i, j, ret = 0;
+	/* before taking the lock: restoring a BO remaps it, which takes it */
+	for (i = 0; i < num; i++) {
+		if (ops[i].unmap)
+			continue;
+		if (ops[i].bo->evicted)
+			pscnv_vram_restore(ops[i].bo);
+		pscnv_vram_lru_touch(ops[i].bo);
+	}
+	mutex_lock(&vs->lock);
+	for (i = 0; i < num; i++) {
+		if (ops[i].unmap) {
+			node = pscnv_vspace_find_map(vs, ops[i].start);
+			if (!node) {
+				ret = -ENOENT;
+				break;
+			}
+			ops[i].bo = node->tag;
+			if (pscnv_vm_debug >= 1)
+				NV_INFO(vs->dev, "VM: vspace %d: Unmapping range %llx-%llx.\n", vs->vid, node->start, node->start + node->size);
+			pscnv_vspace_clear_map(vs, node);
+			atomic_dec(&ops[i].bo->vm_maps);
+			pscnv_mm_free(node);
+			continue;
+		}
+		ret = pscnv_vspace_place(vs, ops[i].bo, ops[i].bo_offset, ops[i].length, ops[i].start, ops[i].end, ops[i].back, &node);
+		if (ret)
+			break;
+		atomic_inc(&ops[i].bo->vm_maps);
+		if (pscnv_vm_debug >= 1)
+			NV_INFO(vs->dev, "VM: vspace %d: Mapping BO %x/%d+%llx at %llx-%llx.\n", vs->vid, ops[i].bo->cookie, ops[i].bo->serial,
+					ops[i].bo_offset, node->start, node->start + node->size);
+		ret = dev_priv->vm->map_ptes(vs, ops[i].bo, node->start, ops[i].bo_offset, ops[i].length);
+		if (ret) {
+			pscnv_vspace_clear_map(vs, node);
+			atomic_dec(&ops[i].bo->vm_maps);
+			pscnv_mm_free(node);
+			break;
+		}
+		ops[i].node = node;
+	}
+	dev_priv->vm->flush(vs);
 	mutex_unlock(&vs->lock);
+	for (j = 0; j < i; j++)
+		if (ops[j].unmap)
+			pscnv_vspace_put_bo(vs, ops[j].bo);
+	*done = i;
 	return ret;
 }
 
+/* Sets size bytes of VA aside, rounded up to large pages and placed as
+ * a map would be. Maps asked for inside the range then go there, and
+ * nowhere else does. With PSCNV_VSPACE_RESV_DUMMY, the pages with
+ * nothing mapped point at the dummy page. */
+int
+pscnv_vspace_reserve(struct pscnv_vspace *vs, uint64_t size, uint64_t start, uint64_t end,
+		int back, uint32_t flags, uint64_t *res)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vspace_resv *resv;
+	uint32_t mmflags = PSCNV_MM_LP;
+	int ret;
+	if (!size || (flags & ~PSCNV_VSPACE_RESV_DUMMY))
+		return -EINVAL;
+	resv = kzalloc(sizeof *resv, GFP_KERNEL);
+	if (!resv)
+		return -ENOMEM;
+	resv->flags = flags;
+	if (back)
+		mmflags |= PSCNV_MM_FROMBACK;
+	mutex_lock(&vs->lock);
+	ret = pscnv_mm_alloc(vs->mm, ALIGN(size, vs->mm->lpsize), mmflags, start, end, &resv->node);
+	if (ret)
+		goto fail_alloc;
+	resv->start = resv->node->start;
+	resv->end = resv->node->start + resv->node->size;
+	ret = pscnv_mm_init(vs->dev, resv->start, resv->end, vs->mm->spsize, vs->mm->lpsize, vs->mm->tssize, &resv->mm);
+	if (ret)
+		goto fail_mm;
+	resv->node->tag = 0;
+	resv->node->tag2 = resv;
+	if (flags & PSCNV_VSPACE_RESV_DUMMY) {
+		ret = dev_priv->vm->dummy_ptes(vs, resv->start, resv->end - resv->start);
+		if (ret) {
+			dev_priv->vm->clear_ptes(vs, resv->start, resv->end - resv->start);
+			dev_priv->vm->flush(vs);
+			goto fail_ptes;
+		}
+		dev_priv->vm->flush(vs);
+	}
+	list_add_tail(&resv->head, &vs->resvs);
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "VM: vspace %d: Reserved range %llx-%llx.\n", vs->vid, resv->start, resv->end);
+	mutex_unlock(&vs->lock);
+	*res = resv->start;
+	return 0;
+
+fail_ptes:
+	pscnv_mm_takedown(resv->mm, pscnv_mm_free);
+fail_mm:
+	pscnv_mm_free(resv->node);
+fail_alloc:
+	mutex_unlock(&vs->lock);
+	kfree(resv);
+	return ret;
+}
+
+/* Gives back a reservation, unmapping everything still mapped in it. */
+int
+pscnv_vspace_release(struct pscnv_vspace *vs, uint64_t start) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_vspace_resv *resv;
+	struct pscnv_mm_node *node;
+	mutex_lock(&vs->lock);
+	resv = pscnv_vspace_find_resv(vs, start, start);
+	if (!resv || resv->start != start) {
+		mutex_unlock(&vs->lock);
+		return -ENOENT;
+	}
+	if (pscnv_vm_debug >= 1)
+		NV_INFO(vs->dev, "VM: vspace %d: Releasing range %llx-%llx.\n", vs->vid, resv->start, resv->end);
+	/* only the PTEs that were written: the rest may have no PTs */
+	if (resv->flags & PSCNV_VSPACE_RESV_DUMMY) {
+		dev_priv->vm->clear_ptes(vs, resv->start, resv->end - resv->start);
+	} else {
+		for (node = pscnv_mm_first(resv->mm); node; node = pscnv_mm_next(node))
+			if (node->type != PSCNV_MM_TYPE_FREE && !node->cached)
+				dev_priv->vm->clear_ptes(vs, node->start, node->size);
+	}
+	dev_priv->vm->flush(vs);
+	list_del(&resv->head);
+	pscnv_mm_free(resv->node);
+	mutex_unlock(&vs->lock);
+	/* the maps left are out of everyone's reach, and flushed */
+	pscnv_mm_takedown(resv->mm, pscnv_vspace_free_unmap);
+	kfree(resv);
+	return 0;
+}
+
+/* Rewrites the PTEs of all mappings of a VRAM BO in one mm of a
+ * vspace, after its backing storage has been moved. */
+static void
+pscnv_vspace_remap_bo_mm(struct pscnv_vspace *vs, struct pscnv_mm *mm, struct pscnv_bo *bo) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_mm_node *node;
+	for (node = pscnv_mm_first(mm); node; node = pscnv_mm_next(node)) {
+		if (node->type == PSCNV_MM_TYPE_FREE || node->cached)
+			continue;
+		if (!node->tag)
+			pscnv_vspace_remap_bo_mm(vs, ((struct pscnv_vspace_resv *)node->tag2)->mm, bo);
+		if (node->tag != bo)
+			continue;
+		if (pscnv_vm_debug >= 1)
+			NV_INFO(vs->dev, "VM: vspace %d: Remapping BO %x/%d at %llx-%llx.\n", vs->vid, bo->cookie, bo->serial, node->start,
+					node->start + node->size);
+		/* unmap first, so that the TLBs get flushed */
+		dev_priv->vm->do_unmap(vs, node->start, node->size);
+		if (dev_priv->vm->do_map(vs, bo, node->start, node->bo_offset, node->bo_length))
+			NV_ERROR(vs->dev, "VM: vspace %d: Failed to remap BO %x/%d at %llx\n", vs->vid, bo->cookie, bo->serial, node->start);
+	}
+}
+
+/* Returns a new reference to vspace vid, fake ones included, or 0. */
+struct pscnv_vspace *
+pscnv_vspace_get(struct drm_device *dev, int vid) {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_vspace *vs = 0;
+	unsigned long flags;
+	if (vid < -3 || vid >= 128)
+		return 0;
+	spin_lock_irqsave(&dev_priv->vm->vs_lock, flags);
+	vs = (vid < 0 ? dev_priv->vm->fake_vspaces[-vid] : dev_priv->vm->vspaces[vid]);
+	if (vs)
+		pscnv_vspace_ref(vs);
+	spin_unlock_irqrestore(&dev_priv->vm->vs_lock, flags);
+	return vs;
+}
+
+void
+pscnv_vspace_remap_bo(struct pscnv_bo *bo) {
+	struct pscnv_vspace *vs;
+	int i;
+	/* fake vspaces first: they hold the BAR1/BAR3 mappings */
+	for (i = -3; i < 128; i++) {
+		if (!i || !(vs = pscnv_vspace_get(bo->dev, i)))
+			continue;
+		mutex_lock(&vs->lock);
+		pscnv_vspace_remap_bo_mm(vs, vs->mm, bo);
+		mutex_unlock(&vs->lock);
+		pscnv_vspace_unref(vs);
+	}
+}
+
+static void
+pscnv_vspace_remap_chunk_mm(struct pscnv_vspace *vs, struct pscnv_mm *mm, struct pscnv_bo *bo, int chunk) {
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	struct pscnv_mm_node *node;
+	for (node = pscnv_mm_first(mm); node; node = pscnv_mm_next(node)) {
+		if (node->type == PSCNV_MM_TYPE_FREE || node->cached)
+			continue;
+		if (!node->tag)
+			pscnv_vspace_remap_chunk_mm(vs, ((struct pscnv_vspace_resv *)node->tag2)->mm, bo, chunk);
+		if (node->tag != bo)
+			continue;
+		/* partial maps only see the chunks they overlap */
+		if ((uint64_t)(chunk + 1) << PSCNV_SYSRAM_CHUNK_SHIFT <= node->bo_offset ||
+				(uint64_t)chunk << PSCNV_SYSRAM_CHUNK_SHIFT >= node->bo_offset + node->bo_length)
+			continue;
+		if (dev_priv->vm->remap_chunk(vs, bo, node->start, node->bo_offset, node->bo_length, chunk))
+			NV_ERROR(vs->dev, "VM: vspace %d: Failed to remap BO %x/%d chunk %d at %llx\n", vs->vid, bo->cookie, bo->serial, chunk, node->start);
+	}
+}
+
+/* Points all mappings of a lazy sysram BO at a chunk that just got its
+ * pages, instead of the dummy page. */
+void
+pscnv_vspace_remap_chunk(struct pscnv_bo *bo, int chunk) {
+	struct pscnv_vspace *vs;
+	int i;
+	for (i = -3; i < 128; i++) {
+		if (!i || !(vs = pscnv_vspace_get(bo->dev, i)))
+			continue;
+		mutex_lock(&vs->lock);
+		pscnv_vspace_remap_chunk_mm(vs, vs->mm, bo, chunk);
+		mutex_unlock(&vs->lock);
+		pscnv_vspace_unref(vs);
+	}
+}
+
 static struct vm_operations_struct pscnv_vram_ops = {
 	.open = drm_gem_vm_open,
 	.close = drm_gem_vm_close,
@@ -221,6 +612,9 @@ int pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
 	case PSCNV_GEM_VRAM_SMALL:
 	case PSCNV_GEM_VRAM_LARGE:
+		if (bo->evicted)
+			pscnv_vram_restore(bo);
+		pscnv_vram_lru_touch(bo);
 		if ((ret = dev_priv->vm->map_user(bo))) {
 			drm_gem_object_unreference_unlocked(obj);
 			return ret;
@@ -238,13 +632,28 @@ int pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 				vma->vm_end - vma->vm_start, PAGE_SHARED);
 	case PSCNV_GEM_SYSRAM_SNOOP:
 	case PSCNV_GEM_SYSRAM_NOSNOOP:
+		/* no struct pages to fault in, mmap the dma-buf instead */
+		if (bo->flags & PSCNV_GEM_PRIME) {
+			drm_gem_object_unreference_unlocked(obj);
+			return -EINVAL;
+		}
+		/* anonymous process pages can't go in a shared file mapping,
+		 * and the caller has them mapped already */
+		if (bo->flags & PSCNV_GEM_USERPTR) {
+			drm_gem_object_unreference_unlocked(obj);
+			return -EINVAL;
+		}
 		/* XXX */
-		vma->vm_flags |= VM_RESERVED;
+		/* no mremap past the size checked above */
+		vma->vm_flags |= VM_RESERVED | VM_DONTEXPAND;
 		vma->vm_ops = &pscnv_sysram_ops;
 		vma->vm_private_data = obj;
 
 		vma->vm_file = filp;
 
+		if (pscnv_sysram_prefault)
+			pscnv_sysram_prefault_vma(vma, bo);
+
 		return 0;
 	default:
 		drm_gem_object_unreference_unlocked(obj);
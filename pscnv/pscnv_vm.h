@@ -28,6 +28,7 @@
 #define __PSCNV_VM_H__
 
 #include <linux/kref.h>
+#include <linux/list.h>
 
 struct pscnv_bo;
 struct pscnv_chan;
@@ -42,15 +43,46 @@ struct pscnv_vspace {
 	uint64_t size;
 	uint32_t flags;
 	void *engdata;
+	/* bytes of page tables and directories, for client accounting */
+	uint64_t pgt_bytes;
+	/* pscnv_vspace_resv list, protected by lock */
+	struct list_head resvs;
+};
+
+/* A range of a user vspace set aside by pscnv_vspace_reserve. It takes
+ * a single node of vs->mm, with no tag and itself as tag2, and has its
+ * own mm that maps asked for inside the range are placed in. */
+struct pscnv_vspace_resv {
+	struct list_head head;
+	struct pscnv_mm_node *node;
+	struct pscnv_mm *mm;
+	uint64_t start;
+	uint64_t end;
+	/* PSCNV_VSPACE_RESV_* */
+	uint32_t flags;
 };
 
 struct pscnv_vm_engine {
 	void (*takedown) (struct drm_device *dev);
 	int (*do_vspace_new) (struct pscnv_vspace *vs);
 	void (*do_vspace_free) (struct pscnv_vspace *vs);
-	int (*place_map) (struct pscnv_vspace *, struct pscnv_bo *, uint64_t start, uint64_t end, int back, struct pscnv_mm_node **res);
-	int (*do_map) (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset);
+	/* allocates the VA of a map from mm: vs->mm, or a reservation's */
+	int (*place_map) (struct pscnv_vspace *, struct pscnv_mm *mm, struct pscnv_bo *, uint64_t bo_offset, uint64_t length,
+			uint64_t start, uint64_t end, int back, struct pscnv_mm_node **res);
+	/* maps length bytes of the BO from bo_offset on at offset */
+	int (*do_map) (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset, uint64_t bo_offset, uint64_t length);
 	int (*do_unmap) (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
+	/* do_map and do_unmap without the flushes, so that many of them can
+	 * share one: flush makes all PTE changes so far visible to the GPU.
+	 * map_ptes cleans up after itself on failure. */
+	int (*map_ptes) (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset, uint64_t bo_offset, uint64_t length);
+	int (*clear_ptes) (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
+	int (*flush) (struct pscnv_vspace *vs);
+	/* points a range at the dummy page, without flushing */
+	int (*dummy_ptes) (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
+	/* rewrites the PTEs of one sysram chunk of a BO mapped as for
+	 * do_map, as far as it is inside the map, and flushes the TLB */
+	int (*remap_chunk) (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset, uint64_t bo_offset, uint64_t length, int chunk);
 	int (*map_user) (struct pscnv_bo *);
 	int (*map_kernel) (struct pscnv_bo *);
 	void (*bar_flush) (struct drm_device *dev);
@@ -59,10 +91,35 @@ struct pscnv_vm_engine {
 	spinlock_t vs_lock;
 };
 
+/* one step of pscnv_vspace_bind */
+struct pscnv_vspace_op {
+	int unmap;
+	/* map: the BO, with a GEM reference for the mapping to take over.
+	 * unmap: set to the BO that was mapped */
+	struct pscnv_bo *bo;
+	/* map: as for pscnv_vspace_map_range. unmap: the mapping's start */
+	uint64_t start;
+	uint64_t end;
+	int back;
+	uint64_t bo_offset;
+	uint64_t length;
+	/* map: the new mapping */
+	struct pscnv_mm_node *node;
+};
+
 extern struct pscnv_vspace *pscnv_vspace_new(struct drm_device *, uint64_t size, uint32_t flags, int fake);
 extern int pscnv_vspace_map(struct pscnv_vspace *, struct pscnv_bo *, uint64_t start, uint64_t end, int back, struct pscnv_mm_node **res);
+extern int pscnv_vspace_map_range(struct pscnv_vspace *, struct pscnv_bo *, uint64_t bo_offset, uint64_t length,
+		uint64_t start, uint64_t end, int back, struct pscnv_mm_node **res);
 extern int pscnv_vspace_unmap(struct pscnv_vspace *, uint64_t start);
 extern int pscnv_vspace_unmap_node(struct pscnv_mm_node *node);
+extern void pscnv_vspace_unmap_nodes(struct pscnv_mm_node **nodes, int num);
+extern int pscnv_vspace_bind(struct pscnv_vspace *, struct pscnv_vspace_op *ops, int num, int *done);
+extern int pscnv_vspace_reserve(struct pscnv_vspace *, uint64_t size, uint64_t start, uint64_t end, int back, uint32_t flags, uint64_t *res);
+extern int pscnv_vspace_release(struct pscnv_vspace *, uint64_t start);
+extern void pscnv_vspace_remap_bo(struct pscnv_bo *bo);
+extern void pscnv_vspace_remap_chunk(struct pscnv_bo *bo, int chunk);
+extern struct pscnv_vspace *pscnv_vspace_get(struct drm_device *dev, int vid);
 
 extern void pscnv_vspace_ref_free(struct kref *ref);
 
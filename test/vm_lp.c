@@ -0,0 +1,195 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2010 PathScale Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * Small against large pages on NV50: time to map and unmap a VRAM BO,
+ * page table memory it takes, and GPU time of M2MF copies reading one
+ * word per 64 KiB across it. There is no TLB miss counter to read, so
+ * the copy time stands in for it: each line hits a different large
+ * page, and a different 16 small ones.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "libpscnv.h"
+#include "libpscnv_ib.h"
+
+#define M2MF_HANDLE 0xd00d5039
+/* M2MF line count limit */
+#define MAX_LINES 2047
+
+static double
+elapsed(struct timeval *tvb)
+{
+	struct timeval tve;
+	gettimeofday(&tve, 0);
+	return (tve.tv_sec - tvb->tv_sec) + (tve.tv_usec - tvb->tv_usec) / 1000000.0;
+}
+
+static int
+run(int fd, const char *name, uint32_t flags, uint64_t size, int iters, int copies)
+{
+	struct pscnv_ib_chan *chan;
+	struct pscnv_ib_bo *dst;
+	struct timeval tvb;
+	uint64_t map_handle, offset, pgt0, pgt1, src;
+	uint32_t handle, lines, l, n;
+	double map_time, copy_time;
+	int ret, i;
+
+	if ((ret = pscnv_ib_chan_new(fd, 0, &chan, 0xdeadbeef, 0, 0))) {
+		printf("chan: failed ret = %d\n", ret);
+		return 1;
+	}
+	if ((ret = pscnv_obj_eng_new(fd, chan->cid, M2MF_HANDLE, 0x5039, 0))) {
+		printf("m2mf: failed ret = %d\n", ret);
+		return 1;
+	}
+	if ((ret = pscnv_ib_bo_alloc(fd, chan->vid, 0x1c, PSCNV_GEM_VRAM_SMALL, 0, 0x10000, 0, &dst))) {
+		printf("dst: failed ret = %d\n", ret);
+		return 1;
+	}
+	if ((ret = pscnv_gem_new(fd, 0x1b, flags, 0, size, 0, &handle, &map_handle))) {
+		printf("new: failed ret = %d\n", ret);
+		return 1;
+	}
+
+	/* above the 512 MiB region the channel's own BOs went to, which
+	 * has small pages */
+	gettimeofday(&tvb, 0);
+	for (i = 0; i < iters; i++) {
+		if ((ret = pscnv_vspace_map(fd, chan->vid, handle, 0x40000000, 1ull << 40, 0, 0, &offset))) {
+			printf("vmap: failed ret = %d\n", ret);
+			return 1;
+		}
+		pscnv_vspace_unmap(fd, chan->vid, offset);
+	}
+	map_time = elapsed(&tvb) / iters;
+
+	/* page tables stay around once allocated: map in a fresh 512 MiB
+	 * region to see what this BO costs */
+	pscnv_getparam(fd, PSCNV_GETPARAM_CLIENT_PGT, &pgt0);
+	if ((ret = pscnv_vspace_map(fd, chan->vid, handle, 0x100000000ull, 1ull << 40, 0, 0, &offset))) {
+		printf("vmap: failed ret = %d\n", ret);
+		return 1;
+	}
+	pscnv_getparam(fd, PSCNV_GETPARAM_CLIENT_PGT, &pgt1);
+
+	BEGIN_RING50(chan, 0, 0, 1);
+	OUT_RING(chan, M2MF_HANDLE);
+	BEGIN_RING50(chan, 0, 0x180, 3);	// DMA_NOTIFY, DMA_IN, DMA_OUT
+	OUT_RING(chan, 0xdeadbeef);
+	OUT_RING(chan, 0xdeadbeef);
+	OUT_RING(chan, 0xdeadbeef);
+	BEGIN_RING50(chan, 0, 0x200, 1);	// LINEAR_IN
+	OUT_RING(chan, 1);
+	BEGIN_RING50(chan, 0, 0x21c, 1);	// LINEAR_OUT
+	OUT_RING(chan, 1);
+	FIRE_RING(chan);
+
+	lines = size >> 16;
+	gettimeofday(&tvb, 0);
+	for (i = 0; i < copies; i++) {
+		for (l = 0; l < lines; l += n) {
+			n = lines - l < MAX_LINES ? lines - l : MAX_LINES;
+			src = offset + ((uint64_t)l << 16);
+			BEGIN_RING50(chan, 0, 0x238, 2);	// OFFSET_IN_HIGH, OFFSET_OUT_HIGH
+			OUT_RING(chan, src >> 32);
+			OUT_RING(chan, dst->vm_base >> 32);
+			BEGIN_RING50(chan, 0, 0x30c, 8);
+			OUT_RING(chan, src);			// OFFSET_IN
+			OUT_RING(chan, dst->vm_base);		// OFFSET_OUT
+			OUT_RING(chan, 0x10000);		// PITCH_IN
+			OUT_RING(chan, 4);			// PITCH_OUT
+			OUT_RING(chan, 4);			// LINE_LENGTH_IN
+			OUT_RING(chan, n);			// LINE_COUNT
+			OUT_RING(chan, 0x101);			// FORMAT
+			OUT_RING(chan, 0);			// BUFFER_NOTIFY
+		}
+	}
+	BEGIN_RING50(chan, 0, 0x50, 1);
+	OUT_RING(chan, 1);
+	FIRE_RING(chan);
+	while (chan->chmap[0x48/4] != 1);
+	copy_time = elapsed(&tvb);
+
+	printf("%-5s map+unmap %9.1f us, page tables %6llu KiB, %d copies %9.3f ms\n",
+		name, map_time * 1000000, (pgt1 - pgt0) >> 10, copies, copy_time * 1000);
+
+	pscnv_vspace_unmap(fd, chan->vid, offset);
+	pscnv_gem_close(fd, handle);
+	pscnv_ib_bo_free(dst);
+	pscnv_chan_free(fd, chan->cid);
+	pscnv_vspace_free(fd, chan->vid);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t size = 256, chipset;
+	int iters = 100, copies = 16;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "s:i:c:")) != -1)
+		switch (c) {
+			case 's':
+				size = strtoull(optarg, 0, 0);
+				break;
+			case 'i':
+				iters = atoi(optarg);
+				break;
+			case 'c':
+				copies = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-s size in MiB] [-i map iterations] [-c copies]\n", argv[0]);
+				return 1;
+		}
+	size <<= 20;
+
+	fd = drmOpen("pscnv", 0);
+	if (fd == -1)
+		return 1;
+	if (pscnv_getparam(fd, PSCNV_GETPARAM_CHIPSET_ID, &chipset) || chipset >= 0xc0) {
+		printf("NV50 family only\n");
+		return 1;
+	}
+
+	if (run(fd, "small", PSCNV_GEM_VRAM_SMALL, size, iters, copies))
+		return 1;
+	if (run(fd, "large", PSCNV_GEM_VRAM_LARGE, size, iters, copies))
+		return 1;
+
+	close(fd);
+	return 0;
+}